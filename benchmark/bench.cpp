@@ -1,101 +1,370 @@
 
+#include <benchmark/benchmark.h>
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
-#include <future>
-#include <iostream>
-#include <string_view>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <numeric>
 #include <thread>
+#include <utility>
 #include <vector>
 
+#include "pools.hpp"
+#include "riften/algorithm.hpp"
+#include "riften/task_group.hpp"
 #include "riften/thiefpool.hpp"
 
-struct clock_tick {
-    std::string name;
-    typename std::chrono::high_resolution_clock::time_point start;
-};
+#if defined(RIFTEN_BENCH_HAVE_TBB)
+#    include <tbb/blocked_range.h>
+#    include <tbb/parallel_for.h>
+#    include <tbb/parallel_reduce.h>
+#    include <tbb/task_group.h>
+#endif
+
+namespace {
+
+// Thread counts 1, 2, 4, ... up to and including the hardware concurrency.
+void sweep(benchmark::internal::Benchmark *b) {
+    std::int64_t hw = std::max(1u, std::thread::hardware_concurrency());
+    for (std::int64_t n = 1; n < hw; n *= 2) {
+        b->Arg(n);
+    }
+    b->Arg(hw);
+}
+
+std::size_t threads(benchmark::State const &state) { return static_cast<std::size_t>(state.range(0)); }
+
+void await(std::atomic<std::size_t> &pending) {
+    while (pending.load(std::memory_order_acquire) != 0) {
+        std::this_thread::yield();
+    }
+}
 
-inline clock_tick tick(std::string const &name, bool print = false) {
-    if (print) {
-        std::cout << "Timing: " << name << '\n';
+// Roughly `n` nanoseconds of work the optimiser cannot remove.
+void spin(std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) {
+        benchmark::DoNotOptimize(i);
     }
-    return {name, std::chrono::high_resolution_clock::now()};
 }
 
-template <typename... Args> int tock(clock_tick &x, Args &&...args) {
-    using namespace std::chrono;
+constexpr std::size_t batch = 10'000;
 
-    auto const stop = high_resolution_clock::now();
+// ----------------------------- Every pool -----------------------------
 
-    auto const time = duration_cast<milliseconds>(stop - x.start).count();
+// Cost of submitting (and running) empty tasks from a thread outside the pool.
+template <typename Pool> void submit_external(benchmark::State &state) {
+    Pool pool(threads(state));
 
-    std::cout << x.name << ": " << time << "/ms";
+    std::atomic<std::size_t> pending = 0;
 
-    (static_cast<void>(std::cout << ',' << ' ' << args), ...);
+    for (auto _ : state) {
+        pending.store(batch, std::memory_order_relaxed);
 
-    std::cout << std::endl;
+        for (std::size_t i = 0; i < batch; ++i) {
+            pool.submit([&pending] { pending.fetch_sub(1, std::memory_order_release); });
+        }
 
-    return time;
+        await(pending);
+    }
+
+    state.SetItemsProcessed(state.iterations() * batch);
 }
 
-template <typename T> void Benchmark(int threads, std::string_view str) {
-    {
-        auto fast = tick("fast");
+// As above but the tasks are submitted by a task, i.e. by one of the pool's own threads.
+template <typename Pool> void submit_internal(benchmark::State &state) {
+    Pool pool(threads(state));
 
-        std::atomic<std::size_t> counter;
+    std::atomic<std::size_t> pending = 0;
 
-        {
-            T pool(threads);
+    for (auto _ : state) {
+        pending.store(batch + 1, std::memory_order_relaxed);
 
-            for (std::size_t i = 0; i < 10'000'000; i++) {
-                pool.enqueue([&]() { counter.fetch_add(1); });
+        pool.submit([&] {
+            for (std::size_t i = 0; i < batch; ++i) {
+                pool.submit([&pending] { pending.fetch_sub(1, std::memory_order_release); });
             }
+            pending.fetch_sub(1, std::memory_order_release);
+        });
+
+        await(pending);
+    }
+
+    state.SetItemsProcessed(state.iterations() * batch);
+}
+
+// Mostly short tasks with every 64th one 100 times longer, submitted in order so the long ones cluster.
+template <typename Pool> void skewed(benchmark::State &state) {
+    Pool pool(threads(state));
+
+    std::atomic<std::size_t> pending = 0;
+
+    for (auto _ : state) {
+        pending.store(batch, std::memory_order_relaxed);
+
+        for (std::size_t i = 0; i < batch; ++i) {
+            pool.submit([&pending, i] {
+                spin(i % 64 == 0 ? 100'000 : 1'000);
+                pending.fetch_sub(1, std::memory_order_release);
+            });
         }
 
-        tock(fast, str, counter.load());
+        await(pending);
     }
 
-    {
-        auto het = tick(" het");
+    state.SetItemsProcessed(state.iterations() * batch);
+}
+
+// Latency of a single task submitted to an idle pool, with percentiles reported as counters (in ns).
+template <typename Pool> void round_trip(benchmark::State &state) {
+    Pool pool(threads(state));
 
-        std::atomic<std::size_t> counter;
+    std::vector<double> samples;
 
-        {
-            T pool(threads);
+    for (auto _ : state) {
+        std::atomic<bool> done = false;
 
-            for (std::size_t i = 0; i < 10'000; i++) {
-                pool.enqueue([&]() {
-                    counter.fetch_add(1);
-                    std::this_thread::sleep_for(std::chrono::microseconds(i));
-                });
-            }
+        auto start = std::chrono::steady_clock::now();
+
+        pool.submit([&done] { done.store(true, std::memory_order_release); });
+
+        while (!done.load(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+
+        auto elapsed = std::chrono::steady_clock::now() - start;
+
+        samples.push_back(std::chrono::duration<double, std::nano>(elapsed).count());
+    }
+
+    std::sort(samples.begin(), samples.end());
+
+    for (auto [name, q] : {std::pair{"p50", 0.5}, std::pair{"p99", 0.99}, std::pair{"p999", 0.999}}) {
+        state.counters[name] = samples[static_cast<std::size_t>(q * static_cast<double>(samples.size() - 1))];
+    }
+}
+
+#define POOL_BENCHMARKS(Pool)                                                                                \
+    BENCHMARK_TEMPLATE(submit_external, Pool)->Apply(sweep)->UseRealTime();                                  \
+    BENCHMARK_TEMPLATE(submit_internal, Pool)->Apply(sweep)->UseRealTime();                                  \
+    BENCHMARK_TEMPLATE(skewed, Pool)->Apply(sweep)->UseRealTime();                                           \
+    BENCHMARK_TEMPLATE(round_trip, Pool)->Apply(sweep)->UseRealTime()
+
+POOL_BENCHMARKS(bench::RiftenPool);
+POOL_BENCHMARKS(bench::MutexPool);
+
+#if defined(RIFTEN_BENCH_HAVE_BS)
+POOL_BENCHMARKS(bench::BSPool);
+#endif
+
+#if defined(RIFTEN_BENCH_HAVE_TBB)
+POOL_BENCHMARKS(bench::TBBPool);
+#endif
+
+#if defined(RIFTEN_BENCH_HAVE_TASKFLOW)
+POOL_BENCHMARKS(bench::TaskflowPool);
+#endif
+
+// As `submit_external` but on a pool of one concrete task type, i.e. without type erasure.
+struct Decrement {
+    std::atomic<std::size_t> *pending = nullptr;
+
+    void operator()() && { pending->fetch_sub(1, std::memory_order_release); }
+};
+
+void submit_typed_riften(benchmark::State &state) {
+    riften::BasicThiefpool<Decrement> pool(threads(state));
+
+    std::atomic<std::size_t> pending = 0;
+
+    for (auto _ : state) {
+        pending.store(batch, std::memory_order_relaxed);
+
+        for (std::size_t i = 0; i < batch; ++i) {
+            pool.push({&pending});
         }
 
-        tock(het, str, counter.load());
+        await(pending);
     }
 
-    {
-        auto slow = tick("slow");
+    state.SetItemsProcessed(state.iterations() * batch);
+}
 
-        std::atomic<std::size_t> counter;
+BENCHMARK(submit_typed_riften)->Apply(sweep)->UseRealTime();
 
-        {
-            T pool(threads);
+// Waiting for a fan-out of empty tasks through a future per task or through one `riften::Batch`.
+void fan_out_futures(benchmark::State &state) {
+    riften::Thiefpool pool(threads(state));
 
-            for (std::size_t i = 0; i < 500; i++) {
-                pool.enqueue([&]() {
-                    counter.fetch_add(1);
-                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                });
-            }
+    std::vector<riften::Future<void>> futures(batch);
+
+    for (auto _ : state) {
+        for (auto &future : futures) {
+            future = pool.enqueue([] {});
+        }
+        for (auto &future : futures) {
+            future.wait();
         }
+    }
+
+    state.SetItemsProcessed(state.iterations() * batch);
+}
+
+void fan_out_batch(benchmark::State &state) {
+    riften::Thiefpool pool(threads(state));
 
-        tock(slow, str, counter.load());
+    for (auto _ : state) {
+        pool.enqueue_n(batch, [](std::size_t i) { benchmark::DoNotOptimize(i); }).wait();
     }
+
+    state.SetItemsProcessed(state.iterations() * batch);
 }
 
-int main() {
-    Benchmark<riften::Thiefpool>(12, "riften");
+BENCHMARK(fan_out_futures)->Apply(sweep)->UseRealTime();
+BENCHMARK(fan_out_batch)->Apply(sweep)->UseRealTime();
+
+// ----------------------------- Fork-join -----------------------------
+
+constexpr int fib_n = 25;
+constexpr std::size_t loop_n = 1 << 22;
+
+std::uint64_t fib(riften::Thiefpool &pool, int n) {
+    if (n < 2) {
+        return static_cast<std::uint64_t>(n);
+    }
+
+    std::uint64_t a = 0;
+
+    riften::TaskGroup group(pool);
+
+    group.spawn([&] { a = fib(pool, n - 1); });
+
+    std::uint64_t b = fib(pool, n - 2);
+
+    group.sync();
+
+    return a + b;
+}
+
+void fib_riften(benchmark::State &state) {
+    riften::Thiefpool pool(threads(state));
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(pool.enqueue([&] { return fib(pool, fib_n); }).get());
+    }
+}
+
+void parallel_for_riften(benchmark::State &state) {
+    riften::Thiefpool pool(threads(state));
+
+    std::vector<double> out(loop_n);
+
+    for (auto _ : state) {
+        riften::parallel_for(pool, std::size_t{0}, loop_n, [&](std::size_t i) {
+            out[i] = std::sqrt(static_cast<double>(i));
+        });
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations() * loop_n);
+}
+
+void parallel_reduce_riften(benchmark::State &state) {
+    riften::Thiefpool pool(threads(state));
+
+    std::vector<double> in(loop_n);
+    std::iota(in.begin(), in.end(), 0.0);
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(riften::parallel_reduce(pool, in.begin(), in.end(), 0.0));
+    }
+
+    state.SetItemsProcessed(state.iterations() * loop_n);
+}
+
+BENCHMARK(fib_riften)->Apply(sweep)->UseRealTime();
+BENCHMARK(parallel_for_riften)->Apply(sweep)->UseRealTime();
+BENCHMARK(parallel_reduce_riften)->Apply(sweep)->UseRealTime();
+
+#if defined(RIFTEN_BENCH_HAVE_TBB)
+
+std::uint64_t fib(int n) {
+    if (n < 2) {
+        return static_cast<std::uint64_t>(n);
+    }
+
+    std::uint64_t a = 0;
+
+    tbb::task_group group;
+
+    group.run([&] { a = fib(n - 1); });
+
+    std::uint64_t b = fib(n - 2);
+
+    group.wait();
+
+    return a + b;
+}
+
+void fib_tbb(benchmark::State &state) {
+    tbb::task_arena arena(static_cast<int>(threads(state)));
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(arena.execute([] { return fib(fib_n); }));
+    }
+}
+
+void parallel_for_tbb(benchmark::State &state) {
+    tbb::task_arena arena(static_cast<int>(threads(state)));
+
+    std::vector<double> out(loop_n);
+
+    for (auto _ : state) {
+        arena.execute([&] {
+            tbb::parallel_for(tbb::blocked_range<std::size_t>(0, loop_n), [&](auto const &range) {
+                for (std::size_t i = range.begin(); i != range.end(); ++i) {
+                    out[i] = std::sqrt(static_cast<double>(i));
+                }
+            });
+        });
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations() * loop_n);
+}
+
+void parallel_reduce_tbb(benchmark::State &state) {
+    tbb::task_arena arena(static_cast<int>(threads(state)));
+
+    std::vector<double> in(loop_n);
+    std::iota(in.begin(), in.end(), 0.0);
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(arena.execute([&] {
+            return tbb::parallel_reduce(
+                tbb::blocked_range<std::size_t>(0, loop_n), 0.0,
+                [&](auto const &range, double sum) {
+                    for (std::size_t i = range.begin(); i != range.end(); ++i) {
+                        sum += in[i];
+                    }
+                    return sum;
+                },
+                std::plus<>{});
+        }));
+    }
+
+    state.SetItemsProcessed(state.iterations() * loop_n);
+}
+
+BENCHMARK(fib_tbb)->Apply(sweep)->UseRealTime();
+BENCHMARK(parallel_for_tbb)->Apply(sweep)->UseRealTime();
+BENCHMARK(parallel_reduce_tbb)->Apply(sweep)->UseRealTime();
+
+#endif
+
+}  // namespace
 
-    return 0;
-}
\ No newline at end of file
+BENCHMARK_MAIN();
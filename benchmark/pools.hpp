@@ -0,0 +1,130 @@
+#pragma once
+
+// Thin adapters giving every pool under comparison the same interface: construct with a thread count, then
+// `submit(f)` a fire-and-forget nullary task, from any thread, including from inside another task. Which
+// third party pools exist is decided by the build, see CMakeLists.txt.
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "riften/thiefpool.hpp"
+
+#if defined(RIFTEN_BENCH_HAVE_BS)
+#    include "BS_thread_pool.hpp"
+#endif
+
+#if defined(RIFTEN_BENCH_HAVE_TBB)
+#    include <tbb/task_arena.h>
+#endif
+
+#if defined(RIFTEN_BENCH_HAVE_TASKFLOW)
+#    include <taskflow/taskflow.hpp>
+#endif
+
+namespace bench {
+
+struct RiftenPool {
+    static constexpr char const *name = "riften";
+
+    explicit RiftenPool(std::size_t threads) : pool(threads) {}
+
+    template <typename F> void submit(F &&f) { pool.enqueue_detach(std::forward<F>(f)); }
+
+    riften::Thiefpool pool;
+};
+
+// The textbook pool: one queue, one mutex, one condition variable.
+class MutexPool {
+  public:
+    static constexpr char const *name = "mutex";
+
+    explicit MutexPool(std::size_t threads) {
+        for (std::size_t i = 0; i < threads; ++i) {
+            _threads.emplace_back([this] {
+                for (;;) {
+                    std::function<void()> task;
+                    {
+                        std::unique_lock lock(_mutex);
+                        _cv.wait(lock, [this] { return _stop || !_tasks.empty(); });
+                        if (_tasks.empty()) {
+                            return;
+                        }
+                        task = std::move(_tasks.front());
+                        _tasks.pop();
+                    }
+                    task();
+                }
+            });
+        }
+    }
+
+    template <typename F> void submit(F &&f) {
+        {
+            std::scoped_lock lock(_mutex);
+            _tasks.emplace(std::forward<F>(f));
+        }
+        _cv.notify_one();
+    }
+
+    ~MutexPool() {
+        {
+            std::scoped_lock lock(_mutex);
+            _stop = true;
+        }
+        _cv.notify_all();
+        for (auto &t : _threads) {
+            t.join();
+        }
+    }
+
+  private:
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::queue<std::function<void()>> _tasks;
+    bool _stop = false;
+    std::vector<std::thread> _threads;
+};
+
+#if defined(RIFTEN_BENCH_HAVE_BS)
+struct BSPool {
+    static constexpr char const *name = "BS";
+
+    explicit BSPool(std::size_t threads) : pool(static_cast<BS::concurrency_t>(threads)) {}
+
+    template <typename F> void submit(F &&f) { pool.detach_task(std::forward<F>(f)); }
+
+    BS::thread_pool pool;
+};
+#endif
+
+#if defined(RIFTEN_BENCH_HAVE_TBB)
+struct TBBPool {
+    static constexpr char const *name = "TBB";
+
+    explicit TBBPool(std::size_t threads) : arena(static_cast<int>(threads), 0) {}
+
+    template <typename F> void submit(F &&f) { arena.enqueue(std::forward<F>(f)); }
+
+    tbb::task_arena arena;
+};
+#endif
+
+#if defined(RIFTEN_BENCH_HAVE_TASKFLOW)
+struct TaskflowPool {
+    static constexpr char const *name = "Taskflow";
+
+    explicit TaskflowPool(std::size_t threads) : executor(threads) {}
+
+    template <typename F> void submit(F &&f) { executor.silent_async(std::forward<F>(f)); }
+
+    tf::Executor executor;
+};
+#endif
+
+}  // namespace bench
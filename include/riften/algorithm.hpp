@@ -0,0 +1,234 @@
+// Written in 2021 by Conor Williams (cw648@cam.ac.uk)
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <concepts>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "thiefpool.hpp"
+
+// Parallel loops built on the work-stealing deques of a `riften::Thiefpool`. Ranges are divided by lazy
+// binary splitting: a task works through its range `grain` elements at a time and, whenever its worker's
+// deque is empty, splits off the second half of what is left for an idle worker to steal. Only stolen work
+// spawns further tasks so very little is paid for splitting, and no futures are allocated. The calling thread
+// helps run tasks while it waits if it is one of the pool's workers, otherwise it blocks.
+
+namespace riften {
+
+namespace detail {
+
+// Pick a grain such that there are a few dozen chunks per worker.
+inline std::size_t auto_grain(Thiefpool const &pool, std::size_t n, std::size_t grain) noexcept {
+    return grain > 0 ? grain : std::max<std::size_t>(1, n / (32 * std::max<std::size_t>(1, pool.size())));
+}
+
+template <typename Loop> void split_run(Loop &loop, std::size_t b, std::size_t e) noexcept;
+
+// The task processing `[b, e)` of `loop`, if the pool discards it the loop fails with a broken promise.
+template <typename Loop> auto split_task(Loop &loop, std::size_t b, std::size_t e) noexcept {
+    return Discardable([&loop, b, e]() noexcept { split_run(loop, b, e); },
+                       [&loop]() noexcept {
+                           loop.join.fail(broken_promise());
+                           loop.join.done();
+                       });
+}
+
+// Process `[b, e)` of `loop`, see above. Each task makes one `leaf` for the contiguous run it processes.
+template <typename Loop> void split_run(Loop &loop, std::size_t b, std::size_t e) noexcept {
+    try {
+        auto leaf = loop.make_leaf(b);
+
+        while (e - b > loop.grain && !loop.join.failed()) {
+            if (PoolAccess::local_empty(loop.pool)) {
+                std::size_t mid = b + (e - b) / 2;
+                loop.join.add();
+                loop.pool.enqueue_detach(split_task(loop, mid, e));
+                e = mid;
+            } else {
+                leaf(b, b + loop.grain);
+                b += loop.grain;
+            }
+        }
+
+        if (!loop.join.failed()) {
+            leaf(b, e);
+            loop.finish(std::move(leaf));
+        }
+    } catch (...) {
+        loop.join.fail(std::current_exception());
+    }
+    loop.join.done();
+}
+
+// Run the whole of `loop` over `[0, n)` and wait for it to finish.
+template <typename Loop> void run_loop(Loop &loop, std::size_t n) {
+    if (n == 0) {
+        return;
+    }
+
+    loop.join.add();
+
+    if (PoolAccess::is_worker(loop.pool)) {
+        split_run(loop, 0, n);
+        PoolAccess::help_until(loop.pool, [&] { return loop.join.ready(); });
+    } else {
+        loop.pool.enqueue_detach(split_task(loop, 0, n));
+        loop.join.wait();
+    }
+
+    loop.join.rethrow_if_failed();
+}
+
+// A loop whose chunks carry no state, calls `body(b, e)` for each chunk.
+template <typename Body> struct ForLoop {
+    Thiefpool &pool;
+    Body &body;
+    std::size_t grain;
+    JoinCounter join;
+
+    auto make_leaf(std::size_t) noexcept {
+        return [this](std::size_t b, std::size_t e) { body(b, e); };
+    }
+
+    template <typename Leaf> void finish(Leaf &&) noexcept {}
+};
+
+// A loop where each task folds its elements into a partial result, combined in order at the end.
+template <typename It, typename T, typename Op> struct ReduceLoop {
+    Thiefpool &pool;
+    It first;
+    Op &op;
+    std::size_t grain;
+    JoinCounter join;
+
+    struct Partial {
+        std::size_t start;
+        T value;
+        Partial *next;
+    };
+
+    std::atomic<Partial *> partials = nullptr;
+
+    struct Leaf {
+        ReduceLoop *loop;
+        std::size_t start;
+        std::optional<T> value;
+
+        void operator()(std::size_t b, std::size_t e) {
+            for (; b != e; ++b) {
+                if (value) {
+                    *value = std::invoke(loop->op, std::move(*value), loop->first[b]);
+                } else {
+                    value.emplace(loop->first[b]);
+                }
+            }
+        }
+    };
+
+    Leaf make_leaf(std::size_t b) noexcept { return {this, b, std::nullopt}; }
+
+    void finish(Leaf &&leaf) {
+        auto *node = new Partial{leaf.start, std::move(*leaf.value), partials.load(relaxed)};
+
+        while (!partials.compare_exchange_weak(node->next, node, std::memory_order_release, relaxed)) {
+        }
+    }
+
+    // Combine the partial results in order, call once the loop is done.
+    T collect(T init) {
+        std::vector<std::unique_ptr<Partial>> sorted;
+
+        for (Partial *node = partials.exchange(nullptr, std::memory_order_acquire); node; node = node->next) {
+            sorted.emplace_back(node);
+        }
+
+        std::sort(sorted.begin(), sorted.end(), [](auto const &a, auto const &b) {
+            return a->start < b->start;
+        });
+
+        for (auto &&node : sorted) {
+            init = std::invoke(op, std::move(init), std::move(node->value));
+        }
+
+        return init;
+    }
+
+    ~ReduceLoop() {
+        for (Partial *node = partials.load(std::memory_order_acquire); node;) {
+            delete std::exchange(node, node->next);
+        }
+    }
+
+    static constexpr std::memory_order relaxed = std::memory_order_relaxed;
+};
+
+}  // namespace detail
+
+// Call `f(i)` for every `i` in `[first, last)` on the threads of `pool`, blocks until done. If any call
+// throws the remaining chunks are skipped and the first exception is rethrown. A `grain` of zero picks one
+// automatically, otherwise at most `grain` elements are processed between checks for idle workers.
+template <std::integral I, typename F>
+requires std::invocable<F &, I>
+void parallel_for(Thiefpool &pool, I first, I last, F &&f, std::size_t grain = 0) {
+    if (last <= first) {
+        return;
+    }
+
+    auto n = static_cast<std::size_t>(last - first);
+
+    auto body = [&](std::size_t b, std::size_t e) {
+        for (; b != e; ++b) {
+            std::invoke(f, static_cast<I>(first + static_cast<I>(b)));
+        }
+    };
+
+    detail::ForLoop<decltype(body)> loop{pool, body, detail::auto_grain(pool, n, grain), {}};
+
+    detail::run_loop(loop, n);
+}
+
+// Call `f(x)` for every element `x` of `[first, last)` on the threads of `pool`, see `parallel_for` above.
+template <std::random_access_iterator It, typename F>
+requires std::invocable<F &, std::iter_reference_t<It>>
+void parallel_for(Thiefpool &pool, It first, It last, F &&f, std::size_t grain = 0) {
+    parallel_for(pool, std::size_t{0}, static_cast<std::size_t>(last - first), [&](std::size_t i) {
+        std::invoke(f, first[i]);
+    }, grain);
+}
+
+// Compute `*(d_first + i) = f(*(first + i))` for every element of `[first, last)` on the threads of `pool`,
+// see `parallel_for`. Returns an iterator past the last element written.
+template <std::random_access_iterator It, std::random_access_iterator Out, typename F>
+requires std::invocable<F &, std::iter_reference_t<It>>
+Out parallel_transform(Thiefpool &pool, It first, It last, Out d_first, F &&f, std::size_t grain = 0) {
+    parallel_for(pool, std::size_t{0}, static_cast<std::size_t>(last - first), [&](std::size_t i) {
+        d_first[i] = std::invoke(f, first[i]);
+    }, grain);
+
+    return d_first + (last - first);
+}
+
+// Like `std::reduce` but on the threads of `pool`. `op` must be associative but need not be commutative as
+// partial results are combined in order. See `parallel_for` for exceptions and `grain`.
+template <std::random_access_iterator It, typename T, typename Op = std::plus<>>
+T parallel_reduce(Thiefpool &pool, It first, It last, T init, Op op = {}, std::size_t grain = 0) {
+    auto n = static_cast<std::size_t>(std::max<std::ptrdiff_t>(0, last - first));
+
+    detail::ReduceLoop<It, T, Op> loop{pool, first, op, detail::auto_grain(pool, n, grain), {}};
+
+    detail::run_loop(loop, n);
+
+    return loop.collect(std::move(init));
+}
+
+}  // namespace riften
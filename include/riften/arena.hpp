@@ -0,0 +1,104 @@
+// Written in 2021 by Conor Williams (cw648@cam.ac.uk)
+
+#pragma once
+
+#include <concepts>
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+#include "thiefpool.hpp"
+
+namespace riften {
+
+// A lightweight handle onto a (by default the process-wide) `riften::Thiefpool` which tracks the tasks
+// submitted through it. Building one costs a few atomics rather than a thread per worker, so short-lived
+// jobs can each have their own "pool" while sharing warm workers. Destroying an arena, or calling `wait`,
+// waits for its tasks only, a worker waiting keeps running tasks instead of blocking.
+class Arena {
+  public:
+    explicit Arena(Thiefpool &pool = Thiefpool::shared()) noexcept : _pool(pool) { _join.add(); }
+
+    Arena(Arena const &other) = delete;
+    Arena &operator=(Arena const &other) = delete;
+
+    // As `Thiefpool::enqueue`, the task counts towards this arena.
+    template <typename... Args, typename F>
+    [[nodiscard]] Future<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>> enqueue(
+        F &&f,
+        Args &&...args) {
+        //
+        auto fn = detail::bind(std::forward<F>(f), std::forward<Args>(args)...);
+
+        _join.add();
+
+        return _pool.enqueue(Tracked{this, std::move(fn)});
+    }
+
+    // As `Thiefpool::enqueue_detach`, the task counts towards this arena.
+    template <typename... Args, typename F> void enqueue_detach(F &&f, Args &&...args) {
+        auto fn = detail::bind(std::forward<F>(f), std::forward<Args>(args)...);
+
+        _join.add();
+
+        _pool.enqueue_detach(Tracked{this, std::move(fn)});
+    }
+
+    // Wait for every task submitted through this arena so far, the arena may be reused afterwards.
+    void wait() noexcept {
+        join();
+        _join.reset();
+        _join.add();
+    }
+
+    Thiefpool &pool() const noexcept { return _pool; }
+
+    ~Arena() noexcept { join(); }
+
+  private:
+    // Marks its task done however it finishes, even if it is discarded without running.
+    template <typename F> struct Tracked {
+        F fn;
+        Arena *arena;
+
+        // Takes over a count already added to `a`.
+        Tracked(Arena *a, F &&f) try : fn(std::move(f)), arena(a) {
+        } catch (...) {
+            a->_join.done();
+        }
+
+        Tracked(Tracked &&other) noexcept(std::is_nothrow_move_constructible_v<F>)
+            : fn(std::move(other.fn)), arena(std::exchange(other.arena, nullptr)) {}
+
+        decltype(auto) operator()() {
+            struct Done {
+                Arena *&arena;
+                ~Done() { std::exchange(arena, nullptr)->_join.done(); }
+            } done{arena};
+
+            return std::invoke(std::move(fn));
+        }
+
+        ~Tracked() {
+            if (arena) {
+                arena->_join.done();
+            }
+        }
+    };
+
+    // Drop the arena's own count and wait for the tasks to finish.
+    void join() noexcept {
+        _join.done();
+
+        if (detail::PoolAccess::is_worker(_pool)) {
+            detail::PoolAccess::help_until(_pool, [&] { return _join.ready(); });
+        } else {
+            _join.wait();
+        }
+    }
+
+    Thiefpool &_pool;
+    detail::JoinCounter _join;
+};
+
+}  // namespace riften
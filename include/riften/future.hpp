@@ -0,0 +1,451 @@
+// Written in 2021 by Conor Williams (cw648@cam.ac.uk)
+
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "function2/function2.hpp"
+
+// Bytes of closure a task stores inline, larger closures are moved into a separately allocated block. The
+// default keeps a whole task within one cache line, 112 gives two lines and fewer boxed closures.
+#if !defined(RIFTEN_THIEFPOOL_TASK_CAPACITY)
+#    define RIFTEN_THIEFPOOL_TASK_CAPACITY 48
+#endif
+
+namespace riften {
+
+template <typename T> class Future;
+
+namespace detail {
+
+// A type-erased, move-only, call-once task.
+using task = fu2::function_base<true, false, fu2::capacity_fixed<RIFTEN_THIEFPOOL_TASK_CAPACITY>, true, false,
+                                void() &&>;
+
+// Something that can run continuations as tasks, implemented by `Thiefpool`.
+class Scheduler {
+  public:
+    virtual void submit(task &&work) = 0;
+
+  protected:
+    ~Scheduler() = default;
+};
+
+// The error of a task that is destroyed without being run.
+inline std::exception_ptr broken_promise() noexcept {
+    return std::make_exception_ptr(std::future_error(std::future_errc::broken_promise));
+}
+
+// A task calling `fn()` which, if it is destroyed without being run (e.g. by `Thiefpool::cancel_pending` or
+// `Overflow::drop_oldest`), calls `discard()` instead so that nothing waiting on it is left hanging.
+template <typename F, typename D> class Discardable {
+  public:
+    Discardable(F fn, D discard) noexcept(std::is_nothrow_move_constructible_v<F>)
+        : _fn(std::move(fn)), _discard(std::move(discard)) {}
+
+    Discardable(Discardable &&other) noexcept(std::is_nothrow_move_constructible_v<F>)
+        : _fn(std::move(other._fn)),
+          _discard(std::move(other._discard)),
+          _armed(std::exchange(other._armed, false)) {}
+
+    Discardable &operator=(Discardable &&other) = delete;
+
+    decltype(auto) operator()() && {
+        _armed = false;
+        return std::invoke(std::move(_fn));
+    }
+
+    ~Discardable() {
+        if (_armed) {
+            _discard();
+        }
+    }
+
+  private:
+    static_assert(std::is_nothrow_move_constructible_v<D> && std::is_nothrow_invocable_v<D &>);
+
+    F _fn;
+    D _discard;
+    bool _armed = true;
+};
+
+// How a value of type T is stored in a shared state.
+template <typename T> struct stored { using type = T; };
+template <typename T> struct stored<T &> { using type = std::reference_wrapper<T>; };
+template <> struct stored<void> { using type = std::monostate; };
+
+// The shared state of a `riften::Future`, reference counted and destroyed through a virtual destructor so
+// that derived classes can keep the task which computes the value in the same allocation. Waiting is a
+// single atomic wait, there is no mutex or condition variable. At most one continuation can be attached,
+// it runs once the result is published, as a task on the state's scheduler if it has one.
+template <typename T> class SharedState {
+  public:
+    SharedState() = default;
+
+    explicit SharedState(Scheduler *scheduler) noexcept : _scheduler(scheduler) {}
+
+    SharedState(SharedState const &other) = delete;
+    SharedState &operator=(SharedState const &other) = delete;
+
+    virtual ~SharedState() = default;
+
+    void retain() noexcept { _refs.fetch_add(1, std::memory_order_relaxed); }
+
+    void release() noexcept {
+        if (_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+    Scheduler *scheduler() const noexcept { return _scheduler; }
+
+    void set_scheduler(Scheduler *scheduler) noexcept { _scheduler = scheduler; }
+
+    template <typename... Args> void set_value(Args &&...args) {
+        _value.emplace(std::forward<Args>(args)...);
+        publish();
+    }
+
+    void set_exception(std::exception_ptr error) noexcept {
+        _error = std::move(error);
+        publish();
+    }
+
+    bool is_ready() const noexcept { return _state.load(std::memory_order_acquire) & ready; }
+
+    void wait() const noexcept {
+        if (is_ready()) {
+            return;
+        }
+        for (std::uint32_t s = _state.fetch_or(waiting, std::memory_order_acquire) | waiting; !(s & ready);) {
+            _state.wait(s, std::memory_order_acquire);
+            s = _state.load(std::memory_order_acquire);
+        }
+    }
+
+    // Run `then` once the result is available, immediately if it already is. If `inline_` is false and
+    // there is a scheduler `then` is scheduled as a task, otherwise it is called on the publishing thread.
+    void attach(task &&then, bool inline_ = false) noexcept {
+        _then = std::move(then);
+        _inline = inline_;
+
+        std::uint32_t s = _state.fetch_or(chained, std::memory_order_acq_rel);
+
+        assert(!(s & chained) && "Only one continuation may be attached to a future.");
+
+        if (s & ready) {
+            run_then();
+        }
+    }
+
+    // Call once ready, moves out the value or rethrows the exception.
+    T take() {
+        if (_error) {
+            std::rethrow_exception(_error);
+        }
+        if constexpr (std::is_void_v<T>) {
+            return;
+        } else if constexpr (std::is_reference_v<T>) {
+            return _value->get();
+        } else {
+            return std::move(*_value);
+        }
+    }
+
+  private:
+    static constexpr std::uint32_t ready = 1;
+    static constexpr std::uint32_t waiting = 2;  // Someone may be blocked in wait(), must notify.
+    static constexpr std::uint32_t chained = 4;  // A continuation has been attached.
+
+    void publish() noexcept {
+        std::uint32_t s = _state.fetch_or(ready, std::memory_order_acq_rel);
+
+        if (s & waiting) {
+            _state.notify_all();
+        }
+        if (s & chained) {
+            run_then();
+        }
+    }
+
+    void run_then() noexcept {
+        if (_scheduler && !_inline) {
+            _scheduler->submit(std::move(_then));
+        } else {
+            std::move(_then)();
+        }
+    }
+
+    mutable std::atomic<std::uint32_t> _state = 0;
+    std::atomic<std::uint32_t> _refs = 1;
+    Scheduler *_scheduler = nullptr;
+    bool _inline = false;
+    task _then;
+    std::optional<typename stored<T>::type> _value;
+    std::exception_ptr _error;
+};
+
+// Fulfil `state` with the result of invoking `f` with `args...`.
+template <typename T, typename F, typename... Args>
+void fulfil(SharedState<T> &state, F &&f, Args &&...args) noexcept {
+    try {
+        if constexpr (std::is_void_v<T>) {
+            std::invoke(std::forward<F>(f), std::forward<Args>(args)...);
+            state.set_value();
+        } else {
+            state.set_value(std::invoke(std::forward<F>(f), std::forward<Args>(args)...));
+        }
+    } catch (...) {
+        state.set_exception(std::current_exception());
+    }
+}
+
+template <typename T, typename F> struct then_result { using type = std::invoke_result_t<F, T>; };
+template <typename F> struct then_result<void, F> { using type = std::invoke_result_t<F>; };
+
+struct FutureAccess {
+    template <typename T> static SharedState<T> *state(Future<T> const &future) noexcept {
+        return future._state;
+    }
+};
+
+}  // namespace detail
+
+// A lightweight replacement for `std::future<T>` as returned by `Thiefpool::enqueue`. The shared state is
+// allocated together with the task that fulfils it and waiting is done through `std::atomic::wait`.
+template <typename T> class Future {
+  public:
+    Future() noexcept = default;
+
+    // Adopts one reference to `state`.
+    explicit Future(detail::SharedState<T> *state) noexcept : _state(state) {}
+
+    Future(Future &&other) noexcept : _state(std::exchange(other._state, nullptr)) {}
+
+    Future &operator=(Future &&other) noexcept {
+        Future(std::move(other)).swap(*this);
+        return *this;
+    }
+
+    void swap(Future &other) noexcept { std::swap(_state, other._state); }
+
+    // True if this future refers to a shared state, false after `get()`/`then()` or if default constructed.
+    bool valid() const noexcept { return _state; }
+
+    // True if the result (value or exception) is available, does not block. Requires `valid()`.
+    bool is_ready() const noexcept {
+        assert(valid());
+        return _state->is_ready();
+    }
+
+    // Block until the result is available. Requires `valid()`.
+    void wait() const noexcept {
+        assert(valid());
+        _state->wait();
+    }
+
+    // Block until the result is available then return it, or rethrow the exception the task exited with.
+    // Requires `valid()`, afterwards `valid() == false`.
+    T get() {
+        assert(valid());
+        _state->wait();
+        std::unique_ptr<detail::SharedState<T>, Release> state{std::exchange(_state, nullptr)};
+        return state->take();
+    }
+
+    // Schedule `f(value)` (or `f()` for `Future<void>`) to run once this future's result is available and
+    // return a future for its result. Nothing blocks: the continuation is pushed onto the deque of the worker
+    // that completes this future, or runs inline if this future did not come from a pool. If this future
+    // completes with an exception `f` is skipped and the exception propagates to the returned future.
+    // Requires `valid()`, afterwards `valid() == false`, only one continuation may be attached per future and
+    // the pool the future came from must outlive the continuation.
+    template <typename F> auto then(F &&f) -> Future<typename detail::then_result<T, std::decay_t<F>>::type> {
+        using U = typename detail::then_result<T, std::decay_t<F>>::type;
+
+        assert(valid());
+
+        auto *next = new detail::SharedState<U>(_state->scheduler());
+
+        next->retain();  // One for the continuation and one for the returned future.
+
+        auto *prev = std::exchange(_state, nullptr);
+
+        prev->attach(detail::Discardable(
+            [prev, next, fn = std::forward<F>(f)]() mutable {
+                std::unique_ptr<detail::SharedState<T>, Release> guard{prev};
+                try {
+                    if constexpr (std::is_void_v<T>) {
+                        prev->take();
+                        detail::fulfil(*next, std::move(fn));
+                    } else {
+                        detail::fulfil(*next, std::move(fn), prev->take());
+                    }
+                } catch (...) {
+                    next->set_exception(std::current_exception());
+                }
+                next->release();
+            },
+            [prev, next]() noexcept {
+                next->set_exception(detail::broken_promise());  // The pool discarded the continuation.
+                next->release();
+                prev->release();
+            }));
+
+        return Future<U>(next);
+    }
+
+    ~Future() noexcept {
+        if (_state) {
+            _state->release();
+        }
+    }
+
+  private:
+    friend struct detail::FutureAccess;
+
+    struct Release {
+        void operator()(detail::SharedState<T> *state) const noexcept { state->release(); }
+    };
+
+    detail::SharedState<T> *_state = nullptr;
+};
+
+namespace detail {
+
+// Combined state of `when_all`/`when_any`, holds the input futures until it is fulfilled. Continuations of
+// the combined future are scheduled on the scheduler of the first input.
+template <typename Seq, typename R = Seq> struct WhenState : SharedState<R> {
+    explicit WhenState(Seq &&seq, std::size_t n) : futures(std::move(seq)), remaining(n) {
+        this->set_scheduler(first_scheduler(futures));
+    }
+
+    template <typename... Ts> static Scheduler *first_scheduler(std::tuple<Future<Ts>...> const &seq) {
+        if constexpr (sizeof...(Ts) > 0) {
+            return FutureAccess::state(std::get<0>(seq))->scheduler();
+        } else {
+            return nullptr;
+        }
+    }
+
+    template <typename T> static Scheduler *first_scheduler(std::vector<Future<T>> const &seq) {
+        return seq.empty() ? nullptr : FutureAccess::state(seq.front())->scheduler();
+    }
+
+    Seq futures;
+    std::atomic<std::size_t> remaining;
+    std::atomic<bool> fired = false;
+};
+
+}  // namespace detail
+
+// Returns a future which becomes ready once all of `futures...` are ready, it holds the (ready) input
+// futures. No thread blocks waiting: the last input to complete fulfils the combined future.
+template <typename... Ts> Future<std::tuple<Future<Ts>...>> when_all(Future<Ts>... futures) {
+    using Seq = std::tuple<Future<Ts>...>;
+
+    auto *state = new detail::WhenState<Seq>(Seq(std::move(futures)...), sizeof...(Ts) + 1);
+
+    state->retain();
+
+    auto arrive = [state]() noexcept {
+        if (state->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            state->set_value(std::move(state->futures));
+            state->release();
+        }
+    };
+
+    std::apply([&](auto &...f) { (detail::FutureAccess::state(f)->attach(arrive, true), ...); },
+               state->futures);
+
+    arrive();  // Our own count, guards against fulfilling before every continuation is attached.
+
+    return Future<Seq>(state);
+}
+
+// Returns a future which becomes ready once all the futures in `[first, last)` are ready, it holds a vector
+// of the (ready) input futures which are moved from the range.
+template <std::forward_iterator It> auto when_all(It first, It last) {
+    using Seq = std::vector<std::iter_value_t<It>>;
+
+    Seq seq(std::make_move_iterator(first), std::make_move_iterator(last));
+
+    auto *state = new detail::WhenState<Seq>(std::move(seq), 0);
+
+    state->remaining.store(state->futures.size() + 1, std::memory_order_relaxed);
+    state->retain();
+
+    auto arrive = [state]() noexcept {
+        if (state->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            state->set_value(std::move(state->futures));
+            state->release();
+        }
+    };
+
+    for (auto &&f : state->futures) {
+        detail::FutureAccess::state(f)->attach(arrive, true);
+    }
+
+    arrive();
+
+    return Future<Seq>(state);
+}
+
+template <typename T> struct WhenAnyResult {
+    std::size_t index;               // Index of the first future to become ready.
+    std::vector<Future<T>> futures;  // All the input futures.
+};
+
+// Returns a future which becomes ready as soon as any of the futures in `[first, last)` is ready, the
+// futures are moved from the range into the result. The futures that were not first remain valid and can be
+// waited on but cannot have continuations attached. The range must not be empty.
+template <std::forward_iterator It> auto when_any(It first, It last) {
+    using T = decltype(std::declval<std::iter_value_t<It> &>().get());
+    using Result = WhenAnyResult<T>;
+
+    std::vector<Future<T>> seq(std::make_move_iterator(first), std::make_move_iterator(last));
+
+    assert(!seq.empty());
+
+    std::vector<detail::SharedState<T> *> inputs;
+
+    for (auto &&f : seq) {
+        inputs.push_back(detail::FutureAccess::state(f));
+    }
+
+    auto *state = new detail::WhenState<std::vector<Future<T>>, Result>(std::move(seq), 0);
+
+    // One reference per input and one for the returned future.
+    for (std::size_t i = 0; i < inputs.size(); i++) {
+        state->retain();
+    }
+
+    for (std::size_t i = 0; i < inputs.size(); i++) {
+        inputs[i]->attach(
+            [state, i]() noexcept {
+                if (!state->fired.exchange(true, std::memory_order_acq_rel)) {
+                    // The other continuations do not touch the futures so they can be handed out now.
+                    state->set_value(Result{i, std::move(state->futures)});
+                }
+                state->release();
+            },
+            true);
+    }
+
+    return Future<Result>(state);
+}
+
+}  // namespace riften
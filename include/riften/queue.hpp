@@ -0,0 +1,346 @@
+// Written in 2021 by Conor Williams (cw648@cam.ac.uk)
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#    include <intrin.h>
+#endif
+
+namespace riften {
+
+namespace detail {
+
+// Assumed size of a cache line, used to pad shared atomics onto their own line.
+inline constexpr std::size_t cache_line = 64;
+
+// Tell the CPU we are in a spin-wait loop, also stops the compiler collapsing the loop.
+inline void cpu_relax() noexcept {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    _mm_pause();
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_ia32_pause();
+#elif defined(__GNUC__) && defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#else
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+}
+
+// Busy-wait for a short while and then start yielding, for waits that are expected to be brief.
+class Backoff {
+  public:
+    void snooze() noexcept {
+        if (_step++ < 64) {
+            cpu_relax();
+        } else {
+            std::this_thread::yield();
+        }
+    }
+
+  private:
+    unsigned _step = 0;
+};
+
+}  // namespace detail
+
+// Lock-free, unbounded, multi-producer multi-consumer FIFO queue. Adapted from crossbeam's `SegQueue`,
+// elements live in a linked list of blocks, producers/consumers claim slots by advancing the tail/head
+// indices with a CAS and blocks are freed by whichever consumer is the last to leave them. Bulk operations
+// claim up to a whole block of slots with a single CAS. T must be nothrow move constructible.
+template <typename T> class Queue {
+    static_assert(std::is_nothrow_move_constructible_v<T>, "T must be nothrow move constructible.");
+
+  public:
+    Queue() = default;
+
+    Queue(Queue const &other) = delete;
+    Queue &operator=(Queue const &other) = delete;
+
+    // Approximate number of elements in the queue.
+    std::size_t size() const noexcept {
+        for (;;) {
+            std::size_t tail = _tail.index.load(seq_cst);
+            std::size_t head = _head.index.load(seq_cst);
+
+            if (_tail.index.load(seq_cst) == tail) {
+                tail = (tail >> shift) + ((tail >> shift) % lap == block_cap);
+                head = (head >> shift) + ((head >> shift) % lap == block_cap);
+
+                std::size_t base = head / lap * lap;
+
+                tail -= base;
+                head -= base;
+
+                return tail - head - tail / lap;
+            }
+        }
+    }
+
+    bool empty() const noexcept {
+        std::size_t head = _head.index.load(seq_cst);
+        std::size_t tail = _tail.index.load(seq_cst);
+        return head >> shift == tail >> shift;
+    }
+
+    template <typename... Args> void emplace(Args &&...args) {
+        T tmp(std::forward<Args>(args)...);
+        push_bulk(std::addressof(tmp), 1);
+    }
+
+    // Move the `n` elements starting at `first` into the queue, in order.
+    void push_bulk(T *first, std::size_t n) {
+        std::size_t tail = _tail.index.load(acquire);
+        Block *block = _tail.block.load(acquire);
+        std::unique_ptr<Block> next_block;
+        detail::Backoff backoff;
+
+        while (n > 0) {
+            std::size_t offset = (tail >> shift) % lap;
+
+            // Another thread is installing the next block.
+            if (offset == block_cap) {
+                backoff.snooze();
+                tail = _tail.index.load(acquire);
+                block = _tail.block.load(acquire);
+                continue;
+            }
+
+            std::size_t count = std::min(n, block_cap - offset);
+
+            if (offset + count == block_cap && !next_block) {
+                next_block = std::make_unique<Block>();
+            }
+
+            // First push into the queue, install the first block.
+            if (!block) {
+                auto fresh = next_block ? std::move(next_block) : std::make_unique<Block>();
+
+                if (_tail.block.compare_exchange_strong(block, fresh.get(), release, relaxed)) {
+                    block = fresh.release();
+                    _head.block.store(block, release);
+                } else {
+                    next_block = std::move(fresh);
+                    tail = _tail.index.load(acquire);
+                    block = _tail.block.load(acquire);
+                }
+                continue;
+            }
+
+            std::size_t new_tail = tail + (count << shift);
+
+            if (_tail.index.compare_exchange_weak(tail, new_tail, seq_cst, acquire)) {
+                // We claimed the last slot of this block, link in the next one (skipping the sentinel).
+                if (offset + count == block_cap) {
+                    Block *next = next_block.release();
+                    _tail.block.store(next, release);
+                    _tail.index.store(new_tail + (1 << shift), release);
+                    block->next.store(next, release);
+                }
+
+                for (std::size_t i = offset; i < offset + count; ++i, ++first) {
+                    ::new (static_cast<void *>(block->slots[i].storage)) T(std::move(*first));
+                    block->slots[i].state.fetch_or(written, release);
+                }
+
+                n -= count;
+                tail = _tail.index.load(acquire);
+                block = _tail.block.load(acquire);
+            } else {
+                block = _tail.block.load(acquire);
+            }
+        }
+    }
+
+    std::optional<T> pop() noexcept {
+        std::optional<T> out;
+        pop_bulk(1, [&](T &&x) noexcept { out.emplace(std::move(x)); });
+        return out;
+    }
+
+    // Pop up to `limit` elements (without crossing a block boundary), in order, passing each to `sink`
+    // which must not throw. Returns the number of elements popped, zero if the queue is empty.
+    template <typename F> std::size_t pop_bulk(std::size_t limit, F &&sink) noexcept {
+        std::size_t head = _head.index.load(acquire);
+        Block *block = _head.block.load(acquire);
+        detail::Backoff backoff;
+
+        for (;;) {
+            std::size_t offset = (head >> shift) % lap;
+
+            // Another thread is installing the next block.
+            if (offset == block_cap) {
+                backoff.snooze();
+                head = _head.index.load(acquire);
+                block = _head.block.load(acquire);
+                continue;
+            }
+
+            std::size_t count = std::min(limit, block_cap - offset);
+            std::size_t new_head = head;
+
+            if ((head & has_next) == 0) {
+                std::atomic_thread_fence(seq_cst);
+                std::size_t tail = _tail.index.load(relaxed);
+
+                if (head >> shift == tail >> shift) {
+                    return 0;
+                }
+
+                if ((head >> shift) / lap != (tail >> shift) / lap) {
+                    new_head |= has_next;  // The tail has moved on, there is a block after this one.
+                } else {
+                    count = std::min(count, (tail >> shift) - (head >> shift));
+                }
+            }
+
+            // The first block has not been installed yet.
+            if (!block) {
+                backoff.snooze();
+                head = _head.index.load(acquire);
+                block = _head.block.load(acquire);
+                continue;
+            }
+
+            new_head += count << shift;
+
+            if (_head.index.compare_exchange_weak(head, new_head, seq_cst, acquire)) {
+                // We claimed the last slot of this block, move the head onto the next one.
+                if (offset + count == block_cap) {
+                    Block *next = block->wait_next();
+                    std::size_t next_index = (new_head & ~has_next) + (1 << shift);
+
+                    if (next->next.load(relaxed)) {
+                        next_index |= has_next;
+                    }
+
+                    _head.block.store(next, release);
+                    _head.index.store(next_index, release);
+                }
+
+                for (std::size_t i = offset; i < offset + count; ++i) {
+                    Slot &slot = block->slots[i];
+
+                    slot.wait_write();
+
+                    T *ptr = std::launder(reinterpret_cast<T *>(slot.storage));
+                    T value(std::move(*ptr));
+                    ptr->~T();
+
+                    // Slot is now free, this may delete the block, do not touch it beyond this point.
+                    if (i + 1 == block_cap) {
+                        Block::destroy(block, 0);
+                    } else if (slot.state.fetch_or(consumed, acq_rel) & destroying) {
+                        Block::destroy(block, i + 1);
+                    }
+
+                    sink(std::move(value));
+                }
+
+                return count;
+            }
+
+            block = _head.block.load(acquire);
+            backoff.snooze();
+        }
+    }
+
+    // Destroys any elements remaining in the queue, no other thread may be using the queue.
+    ~Queue() noexcept {
+        std::size_t head = _head.index.load(relaxed) & ~has_next;
+        std::size_t tail = _tail.index.load(relaxed) & ~has_next;
+        Block *block = _head.block.load(relaxed);
+
+        for (; head != tail; head += 1 << shift) {
+            std::size_t offset = (head >> shift) % lap;
+
+            if (offset < block_cap) {
+                std::launder(reinterpret_cast<T *>(block->slots[offset].storage))->~T();
+            } else {
+                delete std::exchange(block, block->next.load(relaxed));
+            }
+        }
+
+        delete block;
+    }
+
+  private:
+    // Slot state bits.
+    static constexpr std::size_t written = 1;     // Value has been written into the slot.
+    static constexpr std::size_t consumed = 2;    // Value has been read from the slot.
+    static constexpr std::size_t destroying = 4;  // Block is being destroyed, reader must continue the job.
+
+    // Each block spans one "lap" of indices, the last index in every lap is a sentinel and has no slot.
+    static constexpr std::size_t lap = 32;
+    static constexpr std::size_t block_cap = lap - 1;
+
+    // The lowest bit of the head index marks that the head block is not the tail block.
+    static constexpr std::size_t shift = 1;
+    static constexpr std::size_t has_next = 1;
+
+    struct Slot {
+        alignas(T) unsigned char storage[sizeof(T)];
+        std::atomic<std::size_t> state = 0;
+
+        void wait_write() const noexcept {
+            detail::Backoff backoff;
+            while ((state.load(acquire) & written) == 0) {
+                backoff.snooze();
+            }
+        }
+    };
+
+    struct Block {
+        std::atomic<Block *> next = nullptr;
+        Slot slots[block_cap];
+
+        Block *wait_next() const noexcept {
+            detail::Backoff backoff;
+            for (;;) {
+                if (Block *ptr = next.load(acquire)) {
+                    return ptr;
+                }
+                backoff.snooze();
+            }
+        }
+
+        // Mark slots [start, block_cap - 1) for destruction, deletes the block if they have all been read
+        // otherwise the reader of the first unread slot finishes the job.
+        static void destroy(Block *block, std::size_t start) noexcept {
+            for (std::size_t i = start; i < block_cap - 1; ++i) {
+                Slot &slot = block->slots[i];
+
+                if ((slot.state.load(acquire) & consumed) == 0
+                    && (slot.state.fetch_or(destroying, acq_rel) & consumed) == 0) {
+                    return;
+                }
+            }
+            delete block;
+        }
+    };
+
+    struct Position {
+        std::atomic<std::size_t> index = 0;
+        std::atomic<Block *> block = nullptr;
+    };
+
+    alignas(detail::cache_line) Position _head;
+    alignas(detail::cache_line) Position _tail;
+
+    static constexpr std::memory_order relaxed = std::memory_order_relaxed;
+    static constexpr std::memory_order acquire = std::memory_order_acquire;
+    static constexpr std::memory_order release = std::memory_order_release;
+    static constexpr std::memory_order acq_rel = std::memory_order_acq_rel;
+    static constexpr std::memory_order seq_cst = std::memory_order_seq_cst;
+};
+
+}  // namespace riften
@@ -0,0 +1,117 @@
+// Written in 2021 by Conor Williams (cw648@cam.ac.uk)
+
+#pragma once
+
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <system_error>
+#include <vector>
+
+#if defined(__linux__)
+#    include <sys/epoll.h>
+#    include <sys/eventfd.h>
+#    include <unistd.h>
+#endif
+
+namespace riften::detail {
+
+// An epoll instance plus an eventfd which interrupts `wait`, the I/O half of a pool, see
+// `Thiefpool::enqueue_ready`. Only supported on Linux, elsewhere constructing one throws.
+class Reactor {
+  public:
+#if defined(__linux__)
+    Reactor() {
+        _epoll = epoll_create1(EPOLL_CLOEXEC);
+
+        if (_epoll < 0) {
+            throw std::system_error(errno, std::system_category(), "epoll_create1");
+        }
+
+        _event = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+        if (_event < 0) {
+            int error = errno;
+            close_all();
+            throw std::system_error(error, std::system_category(), "eventfd");
+        }
+
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = _event;
+
+        if (epoll_ctl(_epoll, EPOLL_CTL_ADD, _event, &ev) != 0) {
+            int error = errno;
+            close_all();
+            throw std::system_error(error, std::system_category(), "epoll_ctl");
+        }
+    }
+
+    Reactor(Reactor const &other) = delete;
+    Reactor &operator=(Reactor const &other) = delete;
+
+    // Watch `fd` for `events` once: after it has been reported by `wait` it must be armed again.
+    void arm(int fd, std::uint32_t events) {
+        epoll_event ev{};
+        ev.events = events | EPOLLONESHOT;
+        ev.data.fd = fd;
+
+        if (epoll_ctl(_epoll, EPOLL_CTL_MOD, fd, &ev) != 0
+            && (errno != ENOENT || epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &ev) != 0)) {
+            throw std::system_error(errno, std::system_category(), "epoll_ctl");
+        }
+    }
+
+    // Stop watching `fd`, harmless if it is not watched or already closed.
+    void disarm(int fd) noexcept { epoll_ctl(_epoll, EPOLL_CTL_DEL, fd, nullptr); }
+
+    // Block for up to `timeout_ms` milliseconds (forever if negative) or until `notify` is called, returns
+    // the watched file descriptors which became ready.
+    std::vector<int> wait(int timeout_ms) {
+        std::array<epoll_event, 64> events;
+
+        int n = epoll_wait(_epoll, events.data(), static_cast<int>(events.size()), timeout_ms);
+
+        std::vector<int> ready;
+
+        for (int i = 0; i < n; ++i) {
+            if (int fd = events[static_cast<std::size_t>(i)].data.fd; fd != _event) {
+                ready.push_back(fd);
+            } else {
+                std::uint64_t count;
+                [[maybe_unused]] auto drained = ::read(_event, &count, sizeof(count));
+            }
+        }
+
+        return ready;
+    }
+
+    // Make a blocked (or the next) `wait` return, may be called from any thread.
+    void notify() noexcept {
+        std::uint64_t one = 1;
+        [[maybe_unused]] auto written = ::write(_event, &one, sizeof(one));
+    }
+
+    ~Reactor() noexcept { close_all(); }
+
+  private:
+    void close_all() noexcept {
+        if (_event >= 0) {
+            ::close(_event);
+        }
+        ::close(_epoll);
+    }
+
+    int _epoll = -1;
+    int _event = -1;
+#else
+    Reactor() { throw std::system_error(std::make_error_code(std::errc::function_not_supported)); }
+
+    void arm(int, std::uint32_t) {}
+    void disarm(int) noexcept {}
+    std::vector<int> wait(int) { return {}; }
+    void notify() noexcept {}
+#endif
+};
+
+}  // namespace riften::detail
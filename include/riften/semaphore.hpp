@@ -26,166 +26,164 @@
 //	misrepresented as being the original software.
 // 3. This notice may not be removed or altered from any source distribution.
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <chrono>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+#if defined(__linux__)
+#    include <linux/futex.h>
+#    include <sys/syscall.h>
+#    include <time.h>
+#    include <unistd.h>
+#endif
 
 namespace riften {
 
 namespace detail {
 
-#if defined(_WIN32)
-//---------------------------------------------------------
-// Semaphore (Windows)
-//---------------------------------------------------------
-
-#    include <windows.h>
-#    undef min
-#    undef max
-
-class Semaphore {
-  private:
-    HANDLE m_hSema;
-
-    Semaphore(const Semaphore& other) = delete;
-    Semaphore& operator=(const Semaphore& other) = delete;
-
-  public:
-    Semaphore(int initialCount = 0) {
-        assert(initialCount >= 0);
-        m_hSema = CreateSemaphore(NULL, initialCount, MAXLONG, NULL);
-    }
-
-    ~Semaphore() { CloseHandle(m_hSema); }
-
-    void wait() { WaitForSingleObject(m_hSema, INFINITE); }
-
-    void signal(int count = 1) { ReleaseSemaphore(m_hSema, count, NULL); }
-};
-
-#elif defined(__MACH__)
-//---------------------------------------------------------
-// Semaphore (Apple iOS and OSX)
-// Can't use POSIX semaphores due to http://lists.apple.com/archives/darwin-kernel/2009/Apr/msg00010.html
-//---------------------------------------------------------
-
-#    include <mach/mach.h>
-
-class Semaphore {
-  private:
-    semaphore_t m_sema;
-
-    Semaphore(const Semaphore& other) = delete;
-    Semaphore& operator=(const Semaphore& other) = delete;
+// Block while `word == expected`, may return spuriously.
+inline void futex_wait(std::atomic<std::int32_t> &word, std::int32_t expected) noexcept {
+#if defined(__linux__)
+    static_assert(sizeof(std::atomic<std::int32_t>) == sizeof(std::int32_t), "Futex word must be an int.");
+    auto *addr = reinterpret_cast<std::int32_t *>(&word);
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+#else
+    word.wait(expected, std::memory_order_relaxed);
+#endif
+}
+
+// As above but gives up after roughly `timeout`. Without futexes there is no timed atomic wait, we poll.
+inline void futex_wait_for(std::atomic<std::int32_t> &word,
+                           std::int32_t expected,
+                           std::chrono::nanoseconds timeout) noexcept {
+#if defined(__linux__)
+    auto secs = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+    timespec rel{static_cast<time_t>(secs.count()), static_cast<long>((timeout - secs).count())};
+    auto *addr = reinterpret_cast<std::int32_t *>(&word);
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, &rel, nullptr, 0);
+#else
+    using std::chrono::milliseconds;
 
-  public:
-    Semaphore(int initialCount = 0) {
-        assert(initialCount >= 0);
-        semaphore_create(mach_task_self(), &m_sema, SYNC_POLICY_FIFO, initialCount);
+    if (word.load(std::memory_order_relaxed) == expected) {
+        std::this_thread::sleep_for(std::min<std::chrono::nanoseconds>(timeout, milliseconds(1)));
     }
+#endif
+}
 
-    ~Semaphore() { semaphore_destroy(mach_task_self(), m_sema); }
-
-    void wait() { semaphore_wait(m_sema); }
-
-    void signal() { semaphore_signal(m_sema); }
-
-    void signal(int count) {
-        while (count-- > 0) {
-            semaphore_signal(m_sema);
-        }
+// Wake up to `count` threads blocked in `futex_wait` on `word`.
+inline void futex_wake(std::atomic<std::int32_t> &word, std::int32_t count) noexcept {
+#if defined(__linux__)
+    auto *addr = reinterpret_cast<std::int32_t *>(&word);
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+#else
+    if (count == 1) {
+        word.notify_one();
+    } else {
+        word.notify_all();
     }
-};
-
-#elif defined(__unix__)
-//---------------------------------------------------------
-// Semaphore (POSIX, Linux)
-//---------------------------------------------------------
+#endif
+}
 
-#    include <semaphore.h>
+}  // namespace detail
 
+// Counting semaphore whose count doubles as the word the kernel waits on, a futex on Linux and
+// `std::atomic::wait` elsewhere. Releasing never makes a syscall unless a thread is blocked and then makes
+// exactly one, however large the release.
 class Semaphore {
-  private:
-    sem_t m_sema;
-
-    Semaphore(const Semaphore& other) = delete;
-    Semaphore& operator=(const Semaphore& other) = delete;
-
   public:
-    Semaphore(int initialCount = 0) {
-        assert(initialCount >= 0);
-        sem_init(&m_sema, 0, initialCount);
-    }
-
-    ~Semaphore() { sem_destroy(&m_sema); }
-
-    void wait() {
-        // http://stackoverflow.com/questions/2013181/gdb-causes-sem-wait-to-fail-with-eintr-error
-        int rc;
-        do {
-            rc = sem_wait(&m_sema);
-        } while (rc == -1 && errno == EINTR);
+    explicit Semaphore(std::ptrdiff_t desired) : m_count(static_cast<std::int32_t>(desired)) {
+        assert(desired >= 0 && desired <= INT32_MAX);
     }
 
-    void signal() { sem_post(&m_sema); }
+    Semaphore(Semaphore const &other) = delete;
+    Semaphore &operator=(Semaphore const &other) = delete;
 
-    void signal(int count) {
-        while (count-- > 0) {
-            sem_post(&m_sema);
+    void release(std::ptrdiff_t update = 1) {
+        assert(update >= 0 && update <= INT32_MAX);
+        m_count.fetch_add(static_cast<std::int32_t>(update), seq_cst);
+        if (m_waiters.load(seq_cst) > 0) {
+            detail::futex_wake(m_count, static_cast<std::int32_t>(update));
         }
     }
-};
-
-#else
-
-#    error Unsupported platform!
-
-#endif
-
-}  // namespace detail
-
-class Semaphore {
-  public:
-    explicit Semaphore(std::ptrdiff_t desired) : m_count(desired) { assert(desired >= 0); }
 
-    void release(std::ptrdiff_t update = 1) {
-        std::ptrdiff_t oldCount = m_count.fetch_add(update, std::memory_order_release);
-        std::ptrdiff_t toRelease = -oldCount < update ? -oldCount : update;
-        if (toRelease > 0) {
-            m_sema.signal(toRelease);
+    // Consumes all counts in the semaphore if there are any, returns false otherwise.
+    bool try_acquire_many() noexcept {
+        std::int32_t old = m_count.load(relaxed);
+        while (old > 0) {
+            if (m_count.compare_exchange_weak(old, 0, acquire, relaxed)) {
+                return true;
+            }
         }
+        return false;
     }
 
-    // If possible consumes all counts in the semaphore, otherwise blocks until released.
-    void acquire_many() {
-        for (std::ptrdiff_t spin = 0; spin < 10'000; ++spin) {
-            std::ptrdiff_t old = m_count.load(relaxed);
-            if (old > 0 && m_count.compare_exchange_strong(old, 0, acquire)) {
+    // If possible consumes all counts in the semaphore, otherwise blocks until released. Polls the count
+    // `spins` times before blocking.
+    void acquire_many(std::size_t spins = 10'000) {
+        for (std::size_t spin = 0; spin < spins; ++spin) {
+            if (try_acquire_many()) {
                 return;
             }
             std::atomic_signal_fence(acquire);  // Prevent the compiler from collapsing the loop.
         }
 
-        std::ptrdiff_t old = m_count.load(relaxed);
+        m_waiters.fetch_add(1, seq_cst);
 
-        for (;;) {
+        // Releasers increment the count before checking for waiters, we register before checking the count.
+        for (std::int32_t old = m_count.load(seq_cst);;) {
             if (old <= 0) {
-                if (m_count.compare_exchange_strong(old, old - 1, acq_rel, relaxed)) {
-                    m_sema.wait();
-                    return;
+                detail::futex_wait(m_count, old);
+                old = m_count.load(seq_cst);
+            } else if (m_count.compare_exchange_weak(old, 0, seq_cst)) {
+                break;
+            }
+        }
+
+        m_waiters.fetch_sub(1, relaxed);
+    }
+
+    // Like `acquire_many` but gives up at `deadline`, returns true if counts were consumed.
+    template <typename Clock, typename Duration>
+    bool try_acquire_many_until(std::chrono::time_point<Clock, Duration> const &deadline) {
+        if (try_acquire_many()) {
+            return true;
+        }
+
+        m_waiters.fetch_add(1, seq_cst);
+
+        bool acquired = false;
+
+        for (std::int32_t old = m_count.load(seq_cst);;) {
+            if (old > 0) {
+                if (m_count.compare_exchange_weak(old, 0, seq_cst)) {
+                    acquired = true;
+                    break;
                 }
-            } else if (m_count.compare_exchange_strong(old, 0, acq_rel, relaxed)) {
-                return;
+            } else if (auto now = Clock::now(); now < deadline) {
+                detail::futex_wait_for(m_count, old, deadline - now);
+                old = m_count.load(seq_cst);
+            } else {
+                break;
             }
         }
+
+        m_waiters.fetch_sub(1, relaxed);
+
+        return acquired;
     }
 
   private:
-    std::atomic<std::ptrdiff_t> m_count;
-    detail::Semaphore m_sema;
+    std::atomic<std::int32_t> m_count;
+    std::atomic<std::int32_t> m_waiters = 0;  // Threads in, or about to enter, the slow path.
 
     static constexpr std::memory_order relaxed = std::memory_order_relaxed;
-    static constexpr std::memory_order acq_rel = std::memory_order_acq_rel;
     static constexpr std::memory_order acquire = std::memory_order_acquire;
+    static constexpr std::memory_order seq_cst = std::memory_order_seq_cst;
 };
 
 }  // namespace riften
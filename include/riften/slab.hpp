@@ -0,0 +1,165 @@
+// Written in 2021 by Conor Williams (cw648@cam.ac.uk)
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <vector>
+
+#include "queue.hpp"
+
+namespace riften::detail {
+
+// A per-thread allocator of small blocks, used for tasks too big to be stored inline. Each thread allocates
+// from its own free lists without synchronisation. Blocks freed by another thread are pushed onto a
+// lock-free list belonging to their owner (one CAS), which the owner takes back in one go once its own list
+// runs dry. A slab is reference counted by its thread and its live blocks so blocks may outlive the thread
+// that allocated them. Define `RIFTEN_THIEFPOOL_NO_SLAB` to use the global `operator new` instead.
+class Slab {
+  public:
+    // Allocations of more than this many bytes go to the global `operator new`.
+    static constexpr std::size_t max_size = 1024 - alignof(std::max_align_t);
+
+    // Returns storage for `size` bytes, aligned to `alignof(std::max_align_t)`.
+    [[nodiscard]] static void *allocate(std::size_t size) {
+        std::size_t total = size + sizeof(Header);
+
+#if !defined(RIFTEN_THIEFPOOL_NO_SLAB)
+        if (total <= block_size(classes - 1)) {
+            std::size_t cls = 0;
+            while (block_size(cls) < total) {
+                ++cls;
+            }
+            return local().take(cls);
+        }
+#endif
+
+        auto *head = ::new (::operator new(total)) Header{nullptr, 0};
+        return head + 1;
+    }
+
+    // Free storage returned by `allocate`, may be called from any thread.
+    static void deallocate(void *ptr) noexcept {
+        Header *head = static_cast<Header *>(ptr) - 1;
+
+        if (Slab *owner = head->owner) {
+            owner->give(head->cls, ::new (ptr) Node{nullptr});
+        } else {
+            ::operator delete(head);
+        }
+    }
+
+    Slab(Slab const &other) = delete;
+    Slab &operator=(Slab const &other) = delete;
+
+  private:
+    static constexpr std::size_t classes = 5;
+    static constexpr std::size_t chunk_size = 64 * 1024;
+
+    static constexpr std::size_t block_size(std::size_t cls) noexcept { return std::size_t{64} << cls; }
+
+    // Precedes every block, keeps the user's pointer aligned.
+    struct alignas(std::max_align_t) Header {
+        Slab *owner;
+        std::size_t cls;
+    };
+
+    // Overlays the user part of a free block.
+    struct Node {
+        Node *next;
+    };
+
+    struct alignas(cache_line) FreeList {
+        Node *local = nullptr;                // Only touched by the owner.
+        std::atomic<Node *> remote = nullptr;  // Pushed to by other threads.
+    };
+
+    // Owns the calling thread's reference to its slab.
+    struct Handle {
+        Slab *slab;
+
+        Handle() : slab(new Slab) { current = slab; }
+
+        ~Handle() noexcept {
+            current = nullptr;
+            slab->release();
+        }
+    };
+
+    inline static thread_local Slab *current = nullptr;
+
+    Slab() = default;
+
+    ~Slab() noexcept {
+        for (void *chunk : _chunks) {
+            ::operator delete(chunk, std::align_val_t{cache_line});
+        }
+    }
+
+    static Slab &local() {
+        thread_local Handle handle;
+        return *handle.slab;
+    }
+
+    void *take(std::size_t cls) {
+        FreeList &list = _free[cls];
+
+        if (!list.local) {
+            list.local = list.remote.exchange(nullptr, std::memory_order_acquire);
+        }
+        if (!list.local) {
+            refill(cls);
+        }
+
+        Node *node = list.local;
+        list.local = node->next;
+
+        _refs.fetch_add(1, std::memory_order_relaxed);
+
+        return node;
+    }
+
+    void give(std::size_t cls, Node *node) noexcept {
+        FreeList &list = _free[cls];
+
+        if (current == this) {
+            node->next = list.local;
+            list.local = node;
+        } else {
+            node->next = list.remote.load(std::memory_order_relaxed);
+            while (!list.remote.compare_exchange_weak(node->next, node, std::memory_order_release,
+                                                      std::memory_order_relaxed)) {
+            }
+        }
+
+        release();
+    }
+
+    // Carve a fresh chunk into blocks of class `cls`.
+    void refill(std::size_t cls) {
+        _chunks.reserve(_chunks.size() + 1);
+
+        auto *chunk = static_cast<std::byte *>(::operator new(chunk_size, std::align_val_t{cache_line}));
+
+        _chunks.push_back(chunk);
+
+        for (std::size_t offset = 0; offset + block_size(cls) <= chunk_size; offset += block_size(cls)) {
+            auto *head = ::new (chunk + offset) Header{this, cls};
+            _free[cls].local = ::new (static_cast<void *>(head + 1)) Node{_free[cls].local};
+        }
+    }
+
+    void release() noexcept {
+        if (_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+    std::array<FreeList, classes> _free;
+    std::vector<void *> _chunks;
+    std::atomic<std::size_t> _refs = 1;  // The thread's reference plus one per live block.
+};
+
+}  // namespace riften::detail
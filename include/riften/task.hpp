@@ -0,0 +1,214 @@
+// Written in 2021 by Conor Williams (cw648@cam.ac.uk)
+
+#pragma once
+
+#include <cassert>
+#include <concepts>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include "future.hpp"
+#include "thiefpool.hpp"
+
+// Coroutine support for `riften::Thiefpool`. A `riften::Task<T>` is a lazily started coroutine, it runs when
+// it is `co_await`ed and, when it finishes, resumes its awaiter on the same thread by symmetric transfer.
+// Use `co_await pool.schedule()` to move a coroutine onto the pool and `riften::spawn` to start a task
+// from outside of any coroutine.
+
+namespace riften {
+
+template <typename T = void> class Task;
+
+namespace detail {
+
+// Parts of a task's promise that do not depend on its result type.
+class TaskPromiseBase {
+  public:
+    struct FinalAwaitable {
+        bool await_ready() const noexcept { return false; }
+
+        template <typename P> std::coroutine_handle<> await_suspend(std::coroutine_handle<P> self) noexcept {
+            return self.promise()._continuation;
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+
+    FinalAwaitable final_suspend() const noexcept { return {}; }
+
+    void unhandled_exception() noexcept { _error = std::current_exception(); }
+
+    void set_continuation(std::coroutine_handle<> continuation) noexcept { _continuation = continuation; }
+
+  protected:
+    void rethrow_if_failed() const {
+        if (_error) {
+            std::rethrow_exception(_error);
+        }
+    }
+
+  private:
+    std::coroutine_handle<> _continuation = std::noop_coroutine();
+    std::exception_ptr _error;
+};
+
+template <typename T> class TaskPromise : public TaskPromiseBase {
+  public:
+    Task<T> get_return_object() noexcept;
+
+    template <typename U>
+    requires std::constructible_from<typename stored<T>::type, U &&>
+    void return_value(U &&value) {
+        _value.emplace(std::forward<U>(value));
+    }
+
+    // Call once finished, moves out the value or rethrows the exception.
+    T result() {
+        rethrow_if_failed();
+        if constexpr (std::is_reference_v<T>) {
+            return _value->get();
+        } else {
+            return std::move(*_value);
+        }
+    }
+
+  private:
+    std::optional<typename stored<T>::type> _value;
+};
+
+template <> class TaskPromise<void> : public TaskPromiseBase {
+  public:
+    Task<void> get_return_object() noexcept;
+
+    void return_void() const noexcept {}
+
+    void result() const { rethrow_if_failed(); }
+};
+
+}  // namespace detail
+
+// A lazily started coroutine returning a T. Nothing runs until the task is `co_await`ed, the awaiting
+// coroutine is then suspended and the task resumed in its place, when the task finishes the awaiter is
+// resumed on whichever thread finished it. No thread is ever blocked and nothing is allocated beyond the
+// coroutine frame.
+template <typename T> class [[nodiscard]] Task {
+  public:
+    using promise_type = detail::TaskPromise<T>;
+
+    Task() noexcept = default;
+
+    Task(Task const &other) = delete;
+
+    Task(Task &&other) noexcept : _handle(std::exchange(other._handle, nullptr)) {}
+
+    Task &operator=(Task other) noexcept {
+        std::swap(_handle, other._handle);
+        return *this;
+    }
+
+    ~Task() noexcept {
+        if (_handle) {
+            _handle.destroy();
+        }
+    }
+
+    // True if this task owns a coroutine.
+    bool valid() const noexcept { return static_cast<bool>(_handle); }
+
+    // Start the task and suspend the awaiter until it finishes, returns its result or rethrows its exception.
+    auto operator co_await() && noexcept {
+        assert(valid() && "Awaiting an empty task.");
+
+        struct Awaitable {
+            std::coroutine_handle<promise_type> handle;
+
+            bool await_ready() const noexcept { return false; }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+                handle.promise().set_continuation(awaiter);
+                return handle;
+            }
+
+            T await_resume() { return handle.promise().result(); }
+        };
+
+        return Awaitable{_handle};
+    }
+
+  private:
+    friend promise_type;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) noexcept : _handle(handle) {}
+
+    std::coroutine_handle<promise_type> _handle = nullptr;
+};
+
+namespace detail {
+
+template <typename T> Task<T> TaskPromise<T>::get_return_object() noexcept {
+    return Task<T>{std::coroutine_handle<TaskPromise>::from_promise(*this)};
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() noexcept {
+    return Task<void>{std::coroutine_handle<TaskPromise>::from_promise(*this)};
+}
+
+// An eagerly started coroutine that destroys itself when it finishes.
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() const noexcept { return {}; }
+
+        std::suspend_never initial_suspend() const noexcept { return {}; }
+
+        std::suspend_never final_suspend() const noexcept { return {}; }
+
+        void return_void() const noexcept {}
+
+        void unhandled_exception() const noexcept { std::terminate(); }
+    };
+};
+
+// Hop onto `pool`, run `task` and publish its result into `state`, then drop our reference to it.
+template <typename T> Detached drive(Thiefpool &pool, Task<T> task, SharedState<T> *state) {
+    try {
+        co_await pool.schedule();
+
+        if constexpr (std::is_void_v<T>) {
+            co_await std::move(task);
+            state->set_value();
+        } else {
+            state->set_value(co_await std::move(task));
+        }
+    } catch (...) {
+        state->set_exception(std::current_exception());
+    }
+    state->release();
+}
+
+}  // namespace detail
+
+// Start `task` on one of the workers of `pool`, returns a future to its result. Continuations attached to
+// the future are scheduled on `pool`.
+template <typename T> [[nodiscard]] Future<T> spawn(Thiefpool &pool, Task<T> task) {
+    auto *state = new detail::SharedState<T>(detail::PoolAccess::scheduler(pool));
+
+    Future<T> future(state);
+
+    state->retain();
+
+    try {
+        detail::drive(pool, std::move(task), state);
+    } catch (...) {
+        state->release();  // Could not allocate the coroutine frame.
+        throw;
+    }
+
+    return future;
+}
+
+}  // namespace riften
@@ -0,0 +1,232 @@
+// Written in 2021 by Conor Williams (cw648@cam.ac.uk)
+
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <concepts>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "function2/function2.hpp"
+#include "thiefpool.hpp"
+
+namespace riften {
+
+// A dependency graph of tasks, built once then run any number of times on a `riften::Thiefpool`. Each node
+// runs after all of its predecessors, a run starts from the nodes without any. A finishing node decrements
+// its successors' counters: it goes on to run the first one that became ready itself, on the same worker
+// and without a trip through the deque, and pushes the others for idle workers to steal. If any node throws,
+// nodes which have not yet started are skipped and `wait` rethrows the first exception. If the pool discards
+// a pending node (see `Thiefpool::cancel_pending`) the run fails with a broken promise.
+class TaskGraph {
+  public:
+    // Index of a node, in the order they were added.
+    using Node = std::size_t;
+
+    TaskGraph() noexcept { _join.add(); }
+
+    TaskGraph(TaskGraph const &other) = delete;
+    TaskGraph &operator=(TaskGraph const &other) = delete;
+
+    // Add a node which calls `f()`, once per run.
+    template <typename F>
+    requires std::invocable<std::decay_t<F> &>
+    Node emplace(F &&f) {
+        _nodes.push_back({std::forward<F>(f), {}, 0});
+        _dirty = true;
+        return _nodes.size() - 1;
+    }
+
+    // Make `after` wait for `before` to finish, the graph must stay acyclic.
+    void precede(Node before, Node after) {
+        assert(before < _nodes.size() && after < _nodes.size() && "Not a node of this graph.");
+
+        _nodes[before].successors.push_back(after);
+        _nodes[after].predecessors++;
+        _dirty = true;
+    }
+
+    std::size_t size() const noexcept { return _nodes.size(); }
+
+    // Start running every node on `pool`, without blocking. The graph must not be modified, or run again,
+    // until `wait` returns.
+    void run(Thiefpool &pool) {
+        if (_dirty) {
+            prepare();
+        }
+
+        for (std::size_t i = 0; i < _nodes.size(); ++i) {
+            _pending[i].store(_nodes[i].predecessors, std::memory_order_relaxed);  // Ordered by the push.
+        }
+
+        _pool = &pool;
+        _join.add(_nodes.size());
+
+        _pool->enqueue_bulk(_roots.size(), [&](std::size_t k) {
+            return task_for(_roots[k]);
+        });
+    }
+
+    // Wait for the current run to finish, rethrows the first exception any node threw. A worker waiting keeps
+    // running tasks instead of blocking.
+    void wait() {
+        join();
+        _join.reset();
+        _join.add();
+        _join.rethrow_if_failed();
+    }
+
+    // Waits for a run in progress, discarding any exception, wait() first to observe them.
+    ~TaskGraph() noexcept { join(); }
+
+  private:
+    struct Vertex {
+        fu2::unique_function<void()> fn;
+        std::vector<Node> successors;
+        std::size_t predecessors;
+    };
+
+    struct Run {
+        TaskGraph *graph;
+        Node i;
+        void operator()() noexcept { graph->run_from(i); }
+    };
+
+    struct Skip {
+        TaskGraph *graph;
+        Node i;
+        void operator()() noexcept {
+            graph->_join.fail(detail::broken_promise());
+            graph->skip_from(i);
+        }
+    };
+
+    // The task running node `i`, if the pool discards it the run fails with a broken promise.
+    detail::Discardable<Run, Skip> task_for(Node i) noexcept { return {Run{this, i}, Skip{this, i}}; }
+
+    // Count node `i` done without running it, and likewise every successor this makes ready, on this thread.
+    void skip_from(Node i) noexcept {
+        for (;;) {
+            std::optional<Node> next;
+
+            for (Node succ : _nodes[i].successors) {
+                if (_pending[succ].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    if (!next) {
+                        next = succ;
+                    } else {
+                        skip_from(succ);
+                    }
+                }
+            }
+
+            _join.done();
+
+            if (!next) {
+                return;
+            }
+
+            i = *next;
+        }
+    }
+
+    // Run node `i` then, in turn, the first of its successors each node makes ready.
+    void run_from(Node i) noexcept {
+        for (;;) {
+            if (!_join.failed()) {
+                try {
+                    _nodes[i].fn();
+                } catch (...) {
+                    _join.fail(std::current_exception());
+                }
+            }
+
+            std::optional<Node> next;
+
+            for (Node succ : _nodes[i].successors) {
+                if (_pending[succ].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    if (!next) {
+                        next = succ;
+                    } else {
+                        _pool->enqueue_detach(task_for(succ));
+                    }
+                }
+            }
+
+            _join.done();  // Cannot be the last count if there is a `next`.
+
+            if (!next) {
+                return;
+            }
+
+            i = *next;
+        }
+    }
+
+    // Size the counters and find the roots after the graph changed.
+    void prepare() {
+        _pending = std::make_unique<std::atomic<std::size_t>[]>(_nodes.size());
+        _roots.clear();
+
+        for (Node i = 0; i < _nodes.size(); ++i) {
+            if (_nodes[i].predecessors == 0) {
+                _roots.push_back(i);
+            }
+        }
+
+        assert(acyclic() && "A task graph must not have cycles.");
+
+        _dirty = false;
+    }
+
+    // Kahn's algorithm, true if every node is reachable once its predecessors are done.
+    bool acyclic() const {
+        std::vector<std::size_t> remaining(_nodes.size());
+        std::vector<Node> ready = _roots;
+
+        for (Node i = 0; i < _nodes.size(); ++i) {
+            remaining[i] = _nodes[i].predecessors;
+        }
+
+        std::size_t seen = 0;
+
+        while (!ready.empty()) {
+            Node i = ready.back();
+            ready.pop_back();
+            ++seen;
+            for (Node succ : _nodes[i].successors) {
+                if (--remaining[succ] == 0) {
+                    ready.push_back(succ);
+                }
+            }
+        }
+
+        return seen == _nodes.size();
+    }
+
+    // Drop the graph's own count and wait for the nodes to finish.
+    void join() noexcept {
+        _join.done();
+
+        if (_pool && detail::PoolAccess::is_worker(*_pool)) {
+            detail::PoolAccess::help_until(*_pool, [&] { return _join.ready(); });
+        } else {
+            _join.wait();
+        }
+    }
+
+    std::vector<Vertex> _nodes;
+    std::vector<Node> _roots;
+    std::unique_ptr<std::atomic<std::size_t>[]> _pending;  // Predecessors yet to finish, per node.
+    bool _dirty = false;
+    Thiefpool *_pool = nullptr;
+    detail::JoinCounter _join;
+};
+
+}  // namespace riften
@@ -0,0 +1,82 @@
+// Written in 2021 by Conor Williams (cw648@cam.ac.uk)
+
+#pragma once
+
+#include <concepts>
+#include <exception>
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+#include "thiefpool.hpp"
+
+namespace riften {
+
+// Structured fork-join on a `riften::Thiefpool`: `spawn` any number of tasks then `sync` to wait for all of
+// them. A worker that syncs keeps running tasks (most likely the ones it just spawned) rather than blocking
+// so groups can be nested arbitrarily, e.g. for recursive divide-and-conquer, even on a single thread. If any
+// task throws, tasks which have not yet started are skipped and `sync` rethrows the first exception. A task
+// the pool discards before it runs (see `Thiefpool::cancel_pending`) fails the group with a broken promise.
+class TaskGroup {
+  public:
+    explicit TaskGroup(Thiefpool &pool) noexcept : _pool(pool) { _join.add(); }
+
+    TaskGroup(TaskGroup const &other) = delete;
+    TaskGroup &operator=(TaskGroup const &other) = delete;
+
+    // Run `f()` as a task on the pool.
+    template <typename F>
+    requires std::invocable<std::decay_t<F> &>
+    void spawn(F &&f) {
+        _join.add();
+        try {
+            _pool.enqueue_detach(detail::Discardable(
+                [this, fn = std::forward<F>(f)]() mutable noexcept {
+                    if (!_join.failed()) {
+                        try {
+                            std::invoke(fn);
+                        } catch (...) {
+                            _join.fail(std::current_exception());
+                        }
+                    }
+                    _join.done();
+                },
+                [this]() noexcept {
+                    _join.fail(detail::broken_promise());  // Discarded before it ran.
+                    _join.done();
+                }));
+        } catch (...) {
+            _join.done();
+            throw;
+        }
+    }
+
+    // Wait for every task spawned so far, rethrows the first exception any of them threw. The group may be
+    // reused afterwards.
+    void sync() {
+        join();
+        _join.reset();
+        _join.add();
+        _join.rethrow_if_failed();
+    }
+
+    // Waits for outstanding tasks, discarding any exception, sync() first to observe them.
+    ~TaskGroup() noexcept { join(); }
+
+  private:
+    // Drop the group's own count and wait for the tasks to finish.
+    void join() noexcept {
+        _join.done();
+
+        if (detail::PoolAccess::is_worker(_pool)) {
+            detail::PoolAccess::help_until(_pool, [&] { return _join.ready(); });
+        } else {
+            _join.wait();
+        }
+    }
+
+    Thiefpool &_pool;
+    detail::JoinCounter _join;
+};
+
+}  // namespace riften
@@ -2,24 +2,56 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <bit>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <climits>
 #include <concepts>
+#include <coroutine>
 #include <cstdint>
+#include <exception>
 #include <functional>
 #include <future>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <ostream>
 #include <ratio>
+#include <stop_token>
+#include <string>
+#include <system_error>
 #include <thread>
+#include <tuple>
 #include <type_traits>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include "function2/function2.hpp"
+#include "future.hpp"
+#include "queue.hpp"
+#include "reactor.hpp"
 #include "riften/deque.hpp"
 #include "semaphore.hpp"
+#include "slab.hpp"
+#include "topology.hpp"
+#include "trace.hpp"
 #include "xoroshiro128starstar.hpp"
 
 namespace riften {
 
+// The exception stored in the future of a task whose `std::stop_token` was stopped before the task started.
+class TaskCancelled : public std::exception {
+  public:
+    char const *what() const noexcept override { return "riften: task cancelled before it started"; }
+};
+
 namespace detail {
 
 // See: https://en.cppreference.com/w/cpp/thread/thread/thread
@@ -33,62 +65,607 @@ template <typename... Args, typename F> auto bind(F &&f, Args &&...args) {
     };
 }
 
-// Like std::packaged_task<R() &&>, but guarantees no type-erasure.
+// Bind F and args... for `enqueue(std::stop_token, ...)`, F is passed the token first if it accepts it.
+template <typename... Args, typename F> auto bind_token(std::stop_token const &token, F &&f, Args &&...args) {
+    if constexpr (std::invocable<std::decay_t<F>, std::stop_token, std::decay_t<Args>...>) {
+        return detail::bind(std::forward<F>(f), token, std::forward<Args>(args)...);
+    } else {
+        return detail::bind(std::forward<F>(f), std::forward<Args>(args)...);
+    }
+}
+
+template <typename F, typename... Args>
+using bind_token_t = decltype(bind_token(std::declval<std::stop_token const &>(), std::declval<F>(),
+                                         std::declval<Args>()...));
+
+// Runs `fn` unless `token` was stopped first, a cancelled task throws `TaskCancelled` if it fulfils a
+// future (`Report`) and otherwise just returns. The check is a single load so cancelled tasks are cheap to
+// pop and discard.
+template <typename F, bool Report> struct Cancellable {
+    std::stop_token token;
+    F fn;
+
+    decltype(auto) operator()() {
+        if (token.stop_requested()) {
+            if constexpr (Report) {
+                throw TaskCancelled{};
+            } else {
+                return;
+            }
+        }
+        return std::invoke(std::move(fn));
+    }
+};
+
+// Like std::packaged_task<R() &&>, but guarantees no type-erasure. The function is stored in the same
+// allocation as the shared state of the `riften::Future` it fulfils, the task itself is a single pointer.
+// That allocation comes from the thread's `Slab`.
 template <std::invocable F> class NullaryOneShot {
+    using R = std::invoke_result_t<F>;
+
+    struct Job final : SharedState<R> {
+        explicit Job(F &&f) : fn(std::move(f)) {}
+
+        static void *operator new(std::size_t size) { return Slab::allocate(size); }
+
+        static void *operator new(std::size_t size, std::align_val_t align) {
+            return ::operator new(size, align);
+        }
+
+        static void operator delete(void *ptr) noexcept { Slab::deallocate(ptr); }
+
+        static void operator delete(void *ptr, std::align_val_t align) noexcept {
+            ::operator delete(ptr, align);
+        }
+
+        std::optional<F> fn;
+    };
+
   public:
     // Stores a copy of the function
-    NullaryOneShot(F fn) : _fn(std::move(fn)) {}
+    NullaryOneShot(F fn) : _job(new Job(std::move(fn))) {}
 
-    std::future<std::invoke_result_t<F>> get_future() { return _promise.get_future(); }
+    NullaryOneShot(NullaryOneShot &&other) noexcept : _job(std::exchange(other._job, nullptr)) {}
+
+    NullaryOneShot &operator=(NullaryOneShot &&other) noexcept {
+        std::swap(_job, other._job);
+        return *this;
+    }
+
+    // Continuations attached to the future are scheduled on `scheduler` if not null.
+    Future<R> get_future(Scheduler *scheduler = nullptr) {
+        _job->set_scheduler(scheduler);
+        _job->retain();
+        return Future<R>(_job);
+    }
 
     void operator()() && {
+        Job *job = std::exchange(_job, nullptr);
+
+        // The function is destroyed before the result is published, just like a std::packaged_task.
         try {
-            if constexpr (!std::is_same_v<void, std::invoke_result_t<F>>) {
-                _promise.set_value(std::invoke(std::move(_fn)));
+            if constexpr (!std::is_same_v<void, R>) {
+                R result = std::invoke(std::move(*job->fn));
+                job->fn.reset();
+                job->set_value(std::forward<R>(result));
             } else {
-                std::invoke(std::move(_fn));
-                _promise.set_value();
+                std::invoke(std::move(*job->fn));
+                job->fn.reset();
+                job->set_value();
             }
         } catch (...) {
-            _promise.set_exception(std::current_exception());
+            job->fn.reset();
+            job->set_exception(std::current_exception());
+        }
+
+        job->release();
+    }
+
+    // A task that is destroyed without being run breaks its promise.
+    ~NullaryOneShot() {
+        if (_job) {
+            _job->fn.reset();
+            _job->set_exception(broken_promise());
+            _job->release();
+        }
+    }
+
+  private:
+    Job *_job;
+};
+
+// A closure too big to be stored inline in a `task`, moved into a block from the thread's `Slab`.
+template <typename F> class Boxed {
+  public:
+    template <typename U> explicit Boxed(U &&fn) {
+        void *mem = Slab::allocate(sizeof(F));
+        try {
+            _fn = ::new (mem) F(std::forward<U>(fn));
+        } catch (...) {
+            Slab::deallocate(mem);
+            throw;
+        }
+    }
+
+    Boxed(Boxed &&other) noexcept : _fn(std::exchange(other._fn, nullptr)) {}
+
+    Boxed &operator=(Boxed other) noexcept {
+        std::swap(_fn, other._fn);
+        return *this;
+    }
+
+    void operator()() && { std::invoke(std::move(*_fn)); }
+
+    ~Boxed() noexcept {
+        if (_fn) {
+            _fn->~F();
+            Slab::deallocate(_fn);
+        }
+    }
+
+  private:
+    F *_fn = nullptr;
+};
+
+// True if a `task` stores an F without allocating.
+template <typename F>
+inline constexpr bool fits_inline = sizeof(F) <= RIFTEN_THIEFPOOL_TASK_CAPACITY
+                                    && alignof(F) <= alignof(std::max_align_t)
+                                    && std::is_nothrow_move_constructible_v<F>;
+
+// Type-erase `f`, closures that do not fit inline are boxed instead of left to the global allocator.
+template <typename F> task make_task(F &&f) {
+    using D = std::decay_t<F>;
+
+    if constexpr (std::is_same_v<D, task> || fits_inline<D> || alignof(D) > alignof(std::max_align_t)) {
+        return task(std::forward<F>(f));
+    } else {
+        return task(Boxed<D>(std::forward<F>(f)));
+    }
+}
+
+// Identifies the pool (if any) that the current thread is a worker of, and its index within that pool.
+struct WorkerTag {
+    void const *pool = nullptr;
+    std::size_t id = 0;
+};
+
+inline thread_local WorkerTag this_worker;
+
+// Counts the outstanding tasks of a fork-join region and keeps the first exception any of them throws.
+class JoinCounter {
+  public:
+    void add(std::size_t n = 1) noexcept { _pending.fetch_add(n, std::memory_order_relaxed); }
+
+    // Mark one task as finished, the task that finishes last wakes any waiter.
+    void done() noexcept {
+        if (_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            _pending.notify_all();
+            // Nothing may touch *this after this store as the waiter is then free to destroy it.
+            _ready.store(true, std::memory_order_release);
+        }
+    }
+
+    // Record the exception of a failing task, only the first one is kept.
+    void fail(std::exception_ptr error) noexcept {
+        if (!_failed.exchange(true, std::memory_order_relaxed)) {
+            _error = std::move(error);
+        }
+    }
+
+    bool failed() const noexcept { return _failed.load(std::memory_order_relaxed); }
+
+    bool ready() const noexcept { return _ready.load(std::memory_order_acquire); }
+
+    // Block (without helping) until every task is done.
+    void wait() const noexcept {
+        for (std::size_t n = _pending.load(std::memory_order_acquire); n != 0;) {
+            _pending.wait(n, std::memory_order_acquire);
+            n = _pending.load(std::memory_order_acquire);
+        }
+        while (!ready()) {
+            std::this_thread::yield();  // Only spins while the last task finishes up.
+        }
+    }
+
+    // Call once ready, rethrows the first exception thrown by any task.
+    void rethrow_if_failed() {
+        if (_error) {
+            std::rethrow_exception(std::move(_error));
+        }
+    }
+
+    // Make the counter reusable, only valid once every task is done. Any exception is kept until rethrown.
+    void reset() noexcept {
+        _ready.store(false, std::memory_order_relaxed);
+        _failed.store(false, std::memory_order_relaxed);
+    }
+
+  private:
+    std::atomic<std::size_t> _pending = 0;
+    std::atomic<bool> _ready = false;
+    std::atomic<bool> _failed = false;
+    std::exception_ptr _error;
+};
+
+// The shared state of a `riften::Batch`, one allocation for the whole batch. Referenced by the handle and
+// by every task of the batch that has not finished yet.
+class BatchState {
+  public:
+    // Counts `n` tasks plus one for the submitter, see `riften::BasicThiefpool::enqueue_n`.
+    explicit BatchState(std::size_t n) noexcept : _refs(n + 1) { join.add(n + 1); }
+
+    virtual ~BatchState() = default;
+
+    static void *operator new(std::size_t size) { return Slab::allocate(size); }
+
+    static void *operator new(std::size_t size, std::align_val_t align) {
+        return ::operator new(size, align);
+    }
+
+    static void operator delete(void *ptr) noexcept { Slab::deallocate(ptr); }
+
+    static void operator delete(void *ptr, std::align_val_t align) noexcept { ::operator delete(ptr, align); }
+
+    void release() noexcept {
+        if (_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+    // For a task destroyed without running, fails the batch with a broken promise.
+    void discard() noexcept {
+        join.fail(broken_promise());
+        join.done();
+        release();
+    }
+
+    JoinCounter join;
+
+  private:
+    std::atomic<std::size_t> _refs;
+};
+
+// A batch calling `fn(i)` for each of its tasks, `fn` is shared so may be called concurrently.
+template <typename F> class BatchOf : public BatchState {
+  public:
+    template <typename U> BatchOf(std::size_t n, U &&f) : BatchState(n), _fn(std::forward<U>(f)) {}
+
+    // The `i`'th task, skipped if an earlier task threw.
+    void run(std::size_t i) noexcept {
+        if (!join.failed()) {
+            try {
+                std::invoke(_fn, i);
+            } catch (...) {
+                join.fail(std::current_exception());
+            }
         }
+        join.done();
+        release();
     }
 
   private:
-    std::promise<std::invoke_result_t<F>> _promise;
     F _fn;
 };
 
+struct PoolAccess;
+
+// What the per-worker counters count, see `riften::WorkerStats`.
+enum class Stat {
+    executed,
+    local,
+    injected,
+    stolen,
+    failed_steals,
+    wakeups,
+    idle_ns,
+    parked_ns,
+    high_water,
+    count,
+};
+
+// A worker's event counters, written only by that worker and padded to a cache line so they never
+// false-share. Empty, and every update compiled out, unless `RIFTEN_THIEFPOOL_STATS` is defined.
+struct Counters {
+#if defined(RIFTEN_THIEFPOOL_STATS)
+
+    void add(Stat stat, std::uint64_t n = 1) noexcept {
+        auto &counter = _values[static_cast<std::size_t>(stat)];
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    void raise(Stat stat, std::uint64_t value) noexcept {
+        auto &counter = _values[static_cast<std::size_t>(stat)];
+        if (value > counter.load(std::memory_order_relaxed)) {
+            counter.store(value, std::memory_order_relaxed);
+        }
+    }
+
+    std::uint64_t get(Stat stat) const noexcept {
+        return _values[static_cast<std::size_t>(stat)].load(std::memory_order_relaxed);
+    }
+
+    // Nanoseconds on a monotonic clock, for the idle and parked timers.
+    static std::uint64_t now() noexcept {
+        auto since = std::chrono::steady_clock::now().time_since_epoch();
+        return static_cast<std::uint64_t>(std::chrono::nanoseconds(since).count());
+    }
+
+  private:
+    static constexpr std::size_t size = static_cast<std::size_t>(Stat::count);
+
+    alignas(cache_line) std::array<std::atomic<std::uint64_t>, size> _values{};
+#else
+    void add(Stat, std::uint64_t = 1) noexcept {}
+    void raise(Stat, std::uint64_t) noexcept {}
+    std::uint64_t get(Stat) const noexcept { return 0; }
+    static std::uint64_t now() noexcept { return 0; }
+#endif
+};
+
+}  // namespace detail
+
+// One handle for a whole batch of tasks, as returned by `Thiefpool::enqueue_n`. A single countdown, with a
+// slot for the first exception any of the tasks threw, so waiting for N tasks is one wait rather than N.
+class Batch {
+  public:
+    Batch() noexcept = default;
+
+    // Adopts one reference to `state`.
+    explicit Batch(detail::BatchState *state) noexcept : _state(state) {}
+
+    Batch(Batch &&other) noexcept : _state(std::exchange(other._state, nullptr)) {}
+
+    Batch &operator=(Batch &&other) noexcept {
+        Batch(std::move(other)).swap(*this);
+        return *this;
+    }
+
+    void swap(Batch &other) noexcept { std::swap(_state, other._state); }
+
+    // True if this handle refers to a batch, false after `get()` or if default constructed.
+    bool valid() const noexcept { return _state; }
+
+    // True if every task of the batch has finished, does not block. Requires `valid()`.
+    bool is_ready() const noexcept {
+        assert(valid());
+        return _state->join.ready();
+    }
+
+    // Block until every task of the batch has finished. Requires `valid()`.
+    void wait() const noexcept {
+        assert(valid());
+        _state->join.wait();
+    }
+
+    // As `wait` then rethrow the first exception any of the tasks threw. Requires `valid()`, afterwards
+    // `valid() == false`.
+    void get() {
+        wait();
+        Batch done(std::move(*this));
+        done._state->join.rethrow_if_failed();
+    }
+
+    ~Batch() noexcept {
+        if (_state) {
+            _state->release();
+        }
+    }
+
+  private:
+    detail::BatchState *_state = nullptr;
+};
+
+// How a worker that runs out of tasks waits for more. After waking, a worker first searches only its own
+// deque and the injector, then also tries to steal. Each failed search is followed by a busy-wait which
+// doubles in length (up to `max_pause` pause instructions) for `spin_rounds` rounds, then by a yield for
+// `yield_rounds` rounds, after which the worker parks in the kernel if no work is queued anywhere. Spin
+// longer for lower wake-up latency, less on oversubscribed hosts.
+struct IdlePolicy {
+    std::size_t local_rounds = 100;
+    std::size_t spin_rounds = 64;
+    std::size_t yield_rounds = 16;
+    std::size_t max_pause = 64;
+};
+
+// Totals of what the workers of a pool did while idle, for tuning an `IdlePolicy`.
+struct IdleStats {
+    std::uint64_t spins = 0;   // Failed searches followed by a busy-wait.
+    std::uint64_t yields = 0;  // Failed searches followed by a yield.
+    std::uint64_t parks = 0;   // Times a worker went to sleep.
+};
+
+// What one worker has done. Only `spins`, `yields` and `parks` are always counted, the rest stay zero
+// unless `RIFTEN_THIEFPOOL_STATS` is defined (in every translation unit) before including this header.
+struct WorkerStats {
+    std::uint64_t executed = 0;       // Tasks run.
+    std::uint64_t local = 0;          // Tasks popped from the worker's own deque.
+    std::uint64_t injected = 0;       // Tasks taken from the injector.
+    std::uint64_t stolen = 0;         // Tasks stolen from other workers.
+    std::uint64_t failed_steals = 0;  // Steal attempts that came back empty.
+    std::uint64_t spins = 0;
+    std::uint64_t yields = 0;
+    std::uint64_t parks = 0;
+    std::uint64_t wakeups = 0;     // Times the worker was woken by another thread.
+    std::uint64_t idle_ns = 0;     // Time spent searching for work in vain, excluding parked time.
+    std::uint64_t parked_ns = 0;   // Time spent asleep.
+    std::uint64_t high_water = 0;  // Most tasks seen queued in one of the worker's deques.
+};
+
+// A point in time view of every worker's counters, see `Thiefpool::snapshot()`.
+struct PoolStats {
+    std::vector<WorkerStats> workers;
+    WorkerStats total;  // Sums, except for `high_water` which is the maximum.
+};
+
+// Where a pool's workers run. Floating workers are left to the OS scheduler and steal from victims chosen
+// uniformly at random. Pinned workers are bound, in order, to the CPUs returned by `riften::topology()` and
+// steal from their nearest victims first: SMT siblings, then workers sharing an L3, then the same NUMA node
+// and only then remote workers. Pinning is only supported on Linux, elsewhere it is ignored.
+enum class Placement { floating, pinned };
+
+// Scheduling priority of a task. Workers run their own and injected tasks of the highest priority first, and
+// steal in priority order too. A task already running is never preempted.
+enum class Priority { high, normal, background };
+
+// How strongly a task submitted to one worker, see `Thiefpool::enqueue_on`, sticks to it. A preferred task
+// is run by its worker unless another worker runs out of everything else to do and takes it, a pinned task
+// is only ever run by its worker.
+enum class Affinity { preferred, pinned };
+
+// What a submission does when the queue its task would go on is full, see `Backpressure`. A worker never
+// blocks, as it may be the only thread which could make room, it runs the task itself instead. A dropped task
+// is discarded as by `Thiefpool::cancel_pending`: a `TaskGroup`, `TaskGraph`, `Batch` or parallel algorithm
+// losing one of its tasks fails with a broken promise.
+enum class Overflow {
+    block,        // Wait for the workers to make room.
+    run_inline,   // Run the task on the submitting thread.
+    drop_oldest,  // Discard the oldest queued task, whatever waits on it reports a broken promise.
+};
+
+// Caps the number of tasks queued in each of a pool's queues (every worker's deques and inboxes and the
+// injector) at roughly `capacity`, within a batch, so a burst of submissions cannot exhaust memory. Only
+// the queue being pushed to is checked, its size is a few loads, and nothing at all when unbounded.
+struct Backpressure {
+    std::size_t capacity = SIZE_MAX;  // The default, unbounded.
+    Overflow overflow = Overflow::block;
+};
+
+// What to do with tasks that have not started yet when shutting down a phase of work, see
+// `Thiefpool::shutdown`. Draining runs them, cancelling discards them: their futures report a broken
+// promise.
+enum class Shutdown { drain, cancel };
+
+namespace detail {
+
+// The base of a pool storing `Task`s, only a pool of type-erased tasks schedules future continuations.
+template <typename Pool, typename Task> struct SchedulerFor {};
+
+template <typename Pool> struct SchedulerFor<Pool, task> : Scheduler {
+    void submit(task &&work) override { static_cast<Pool *>(this)->execute(std::move(work)); }
+};
+
 }  // namespace detail
 
 // Lightweight, fast, work-stealing thread-pool for C++20. Built on the lock-free concurrent `riften::Deque`.
+// Tasks submitted from outside the pool go through a lock-free multi-producer `riften::Queue`, workers drain
+// it in batches into their own deques.
 // Upon destruction the threadpool blocks until all tasks have been completed and all threads have joined.
-class Thiefpool {
+//
+// The deques store `Task`s by value. The default, `riften::Thiefpool`, type-erases every callable and has
+// the full interface. A pool of one concrete task type, e.g. a small trivially copyable struct, skips the
+// type erasure: no indirect call and no allocation per task, at the cost of only accepting that type through
+// `push` and `enqueue_bulk`. `Task` must be default constructible, nothrow move constructible and callable
+// as an rvalue, it must not throw.
+template <typename Task = detail::task>
+class BasicThiefpool : detail::SchedulerFor<BasicThiefpool<Task>, Task> {
   public:
-    // Construct a `Thiefpool` with `num_threads` threads.
-    explicit Thiefpool(std::size_t num_threads = std::thread::hardware_concurrency()) : _deques(num_threads) {
-        for (std::size_t i = 0; i < num_threads; ++i) {
-            _threads.emplace_back([&, id = i](std::stop_token tok) {
-                jump(id);  // Get a different random stream
+    static_assert(std::is_default_constructible_v<Task>, "Task must be default constructible.");
+    static_assert(std::is_nothrow_move_constructible_v<Task>, "Task must be nothrow move constructible.");
+    static_assert(std::is_invocable_v<Task>, "Task must be callable as an rvalue.");
+
+    using task_type = Task;
+
+    // True for `riften::Thiefpool`, whose tasks can be any callable.
+    static constexpr bool erased = std::is_same_v<Task, detail::task>;
+
+    // The clock timers are measured against.
+    using clock = std::chrono::steady_clock;
+    using time_point = clock::time_point;
+
+    // Construct a pool with `num_threads` threads (at least one, `hardware_concurrency()` may report zero)
+    // whose idle workers behave according to `idle` and are placed according to `placement`, and whose
+    // queues are bounded by `backpressure`.
+    explicit BasicThiefpool(std::size_t num_threads = std::thread::hardware_concurrency(),
+                            IdlePolicy idle = {},
+                            Placement placement = Placement::floating,
+                            Backpressure backpressure = {})
+        : _idle(idle),
+          _backpressure(backpressure),
+          _active(std::max<std::size_t>(num_threads, 1)),
+          _parked((_active.load(relaxed) + 63) / 64),
+          _deques(_active.load(relaxed)) {
+        //
+        std::vector<Cpu> cpus = placement == Placement::pinned ? topology() : std::vector<Cpu>{};
+
+        plan_victims(cpus);
+
+        for (std::size_t i = 0; i < _deques.size(); ++i) {
+            // A different stream per worker and per pool, seeding is O(1).
+            _deques[i].rng = Xoroshiro128StarStar(reinterpret_cast<std::uintptr_t>(this) + i);
+        }
+
+        for (std::size_t i = 0; i < _deques.size(); ++i) {
+            std::optional<std::size_t> cpu;
+
+            if (!cpus.empty()) {
+                cpu = cpus[i % cpus.size()].id;
+            }
+
+            _threads.emplace_back([&, id = i, cpu](std::stop_token tok) {
+                if (cpu) {
+                    // First, so that what this thread allocates (its tasks, a grown deque) is on its node.
+                    detail::pin_this_thread(*cpu);
+                }
+
+                detail::this_worker = {this, id};
+
                 do {
-                    // Wait to be signalled
-                    _deques[id].sem.acquire_many();
+                    // Wait to be woken, we have already spun before parking. We then count as searching.
+                    park(id, tok);
 
-                    std::size_t spin = 0;
+                    bool searching = true;
+                    std::size_t searches = 0;
+                    std::size_t failed = 0;
+                    std::size_t ran = 0;
+                    std::uint64_t idle_since = 0;
 
-                    do {
-                        // Prioritise our work otherwise steal
-                        std::size_t t = spin++ < 100 || !_deques[id].tasks.empty()
-                                            ? id
-                                            : xoroshiro128() % _deques.size();
+                    detail::Counters &stats = _deques[id].stats;
 
-                        if (std::optional one_shot = _deques[t].tasks.steal()) {
-                            _in_flight.fetch_sub(1, std::memory_order_release);
+                    for (;;) {
+                        // A worker retired by `resize` only finishes what is queued on its own deque.
+                        bool retired = id >= _active.load(relaxed);
+                        bool local_only = searches++ < _idle.local_rounds;
+
+                        // Prioritise our work otherwise steal
+                        if (std::optional one_shot = retired ? pop_local(id) : find_task(id, local_only)) {
+                            // The last searcher to find work wakes a replacement, in case there is more.
+                            if (std::exchange(searching, false) && _searching.fetch_sub(1, seq_cst) == 1) {
+                                wake();
+                            }
+                            if (std::exchange(failed, 0) > 0) {
+                                stats.add(detail::Stat::idle_ns, stats.now() - idle_since);
+                            }
+                            _deques[id].trace.record(TraceEvent::begin);
                             std::invoke(std::move(*one_shot));
+                            _deques[id].trace.record(TraceEvent::end);
+                            count(_deques[id].completed);
+                            stats.add(detail::Stat::executed);
+
+                            if constexpr (erased) {
+                                if (++ran % timer_poll == 0) {
+                                    poll_timers();  // In case no worker is idle to drive the timers.
+                                }
+                            }
+                        } else {
+                            if (!std::exchange(searching, true)) {
+                                _searching.fetch_add(1, seq_cst);
+                            }
+                            if (failed == 0) {
+                                idle_since = stats.now();
+                            }
+                            if (retired || !back_off(id, failed++)) {
+                                stats.add(detail::Stat::idle_ns, stats.now() - idle_since);
+                                break;  // Loop until there is no queued work left anywhere.
+                            }
                         }
+                    }
+
+                    _searching.fetch_sub(1, seq_cst);
 
-                        // Loop until all the work is done.
-                    } while (_in_flight.load(std::memory_order_acquire) > 0);
+                    if (id >= _active.load(seq_cst) && work_available(id)) {
+                        wake();  // We will not look for it, make sure an active worker does.
+                    }
 
                 } while (!tok.stop_requested());
             });
@@ -96,16 +673,50 @@ class Thiefpool {
     }
 
     // Enqueue callable `f` into the threadpool. Like `std::async`/`std::thread` a copy of `args...` is made,
-    // use `std::ref` if you really want a reference. Returns a `std::future<...>` which does not block upon
-    // destruction.
+    // use `std::ref` if you really want a reference. Returns a `riften::Future<...>` which does not block
+    // upon destruction.
     template <typename... Args, typename F>
-    [[nodiscard]] std::future<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>> enqueue(
+    requires erased
+    [[nodiscard]] Future<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>> enqueue(
+        F &&f,
+        Args &&...args) {
+        //
+        return enqueue(Priority::normal, std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    // As above but the task is run with the given `priority`.
+    template <typename... Args, typename F>
+    requires erased
+    [[nodiscard]] Future<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>> enqueue(
+        Priority priority,
         F &&f,
         Args &&...args) {
         //
         auto task = detail::NullaryOneShot(detail::bind(std::forward<F>(f), std::forward<Args>(args)...));
 
-        auto future = task.get_future();
+        auto future = task.get_future(this);
+
+        execute(std::move(task), priority);
+
+        return future;
+    }
+
+    // As `enqueue` but the task is skipped if `token` is stopped before it starts, its future then holds a
+    // `riften::TaskCancelled`. Share one `std::stop_source` between related tasks to cancel them as a group.
+    // If `f` accepts a `std::stop_token` as its first argument it is also passed `token`, to stop early.
+    template <typename... Args, typename F>
+    requires erased
+    [[nodiscard]] Future<std::invoke_result_t<detail::bind_token_t<F, Args...>>> enqueue(
+        std::stop_token token,
+        F &&f,
+        Args &&...args) {
+        //
+        using Bound = detail::bind_token_t<F, Args...>;
+
+        auto task = detail::NullaryOneShot(detail::Cancellable<Bound, true>{
+            token, detail::bind_token(token, std::forward<F>(f), std::forward<Args>(args)...)});
+
+        auto future = task.get_future(this);
 
         execute(std::move(task));
 
@@ -115,42 +726,1363 @@ class Thiefpool {
     // Enqueue callable `f` into the threadpool. Like `std::async`/`std::thread` a copy of `args...` is made,
     // use `std::ref` if you really want a reference. This version does *not* return a handle to the called
     // function and thus only accepts functions which return void.
-    template <typename... Args, typename F> void enqueue_detach(F &&f, Args &&...args) {
+    template <typename... Args, typename F>
+    requires erased
+    void enqueue_detach(F &&f, Args &&...args) {
+        enqueue_detach(Priority::normal, std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    // As above but the task is run with the given `priority`.
+    template <typename... Args, typename F>
+    requires erased
+    void enqueue_detach(Priority priority, F &&f, Args &&...args) {
         // Cleaner error message than concept
         static_assert(std::is_same_v<void, std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>>,
                       "Function must return void.");
 
-        execute(detail::bind(std::forward<F>(f), std::forward<Args>(args)...));
+        execute(detail::bind(std::forward<F>(f), std::forward<Args>(args)...), priority);
     }
 
-    ~Thiefpool() {
-        for (auto &t : _threads) {
-            t.request_stop();
-        }
-        for (auto &d : _deques) {
-            d.sem.release();
+    // As `enqueue_detach` but the task is skipped if `token` is stopped before it starts, see
+    // `enqueue(std::stop_token, ...)`.
+    template <typename... Args, typename F>
+    requires erased
+    void enqueue_detach(std::stop_token token, F &&f, Args &&...args) {
+        using Bound = detail::bind_token_t<F, Args...>;
+
+        // Cleaner error message than concept
+        static_assert(std::is_same_v<void, std::invoke_result_t<Bound>>, "Function must return void.");
+
+        execute(detail::Cancellable<Bound, false>{
+            token, detail::bind_token(token, std::forward<F>(f), std::forward<Args>(args)...)});
+    }
+
+    // As `enqueue` but if the queue the task would go on is full it is neither queued nor handled according
+    // to the pool's `Backpressure`, an empty optional is returned instead.
+    template <typename... Args, typename F>
+    requires erased
+    [[nodiscard]] std::optional<Future<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>>>
+    try_enqueue(F &&f, Args &&...args) {
+        auto task = detail::NullaryOneShot(detail::bind(std::forward<F>(f), std::forward<Args>(args)...));
+
+        auto future = task.get_future(this);
+
+        if (!execute(std::move(task), Priority::normal, true)) {
+            return std::nullopt;
         }
+
+        return future;
     }
 
-  private:
-    // Fire and forget interface.
-    template <std::invocable F> void execute(F &&f) {
-        std::size_t i = count++ % _deques.size();
+    // As `enqueue_detach` but returns false, without queueing the task, if the queue it would go on is full.
+    template <typename... Args, typename F>
+    requires erased
+    [[nodiscard]] bool try_enqueue_detach(F &&f, Args &&...args) {
+        // Cleaner error message than concept
+        static_assert(std::is_same_v<void, std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>>,
+                      "Function must return void.");
 
-        _in_flight.fetch_add(1, std::memory_order_relaxed);
-        _deques[i].tasks.emplace(std::forward<F>(f));
-        _deques[i].sem.release();
+        return execute(detail::bind(std::forward<F>(f), std::forward<Args>(args)...), Priority::normal, true);
     }
 
-    struct named_pair {
-        Semaphore sem{0};
-        Deque<fu2::unique_function<void() &&>> tasks;
-    };
+    // As `enqueue` but the task is queued for worker `worker % size()`, e.g. because it touches state
+    // that is hot in that worker's cache. See `worker_for` to route tasks by key and `riften::Affinity`.
+    template <typename... Args, typename F>
+    requires erased
+    [[nodiscard]] Future<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>> enqueue_on(
+        std::size_t worker,
+        F &&f,
+        Args &&...args) {
+        //
+        return enqueue_on(worker, Affinity::preferred, std::forward<F>(f), std::forward<Args>(args)...);
+    }
 
-    std::atomic<std::int64_t> _in_flight;
-    std::size_t count = 0;
-    std::vector<named_pair> _deques;
-    std::vector<std::jthread> _threads;
-};
+    // As above but with the given `affinity`.
+    template <typename... Args, typename F>
+    requires erased
+    [[nodiscard]] Future<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>> enqueue_on(
+        std::size_t worker,
+        Affinity affinity,
+        F &&f,
+        Args &&...args) {
+        //
+        auto task = detail::NullaryOneShot(detail::bind(std::forward<F>(f), std::forward<Args>(args)...));
+
+        auto future = task.get_future(this);
+
+        execute_on(worker, affinity, std::move(task));
+
+        return future;
+    }
+
+    // As `enqueue_detach` but the task is queued for worker `worker % size()`, see `enqueue_on`.
+    template <typename... Args, typename F>
+    requires erased
+    void enqueue_detach_on(std::size_t worker, F &&f, Args &&...args) {
+        enqueue_detach_on(worker, Affinity::preferred, std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    // As above but with the given `affinity`.
+    template <typename... Args, typename F>
+    requires erased
+    void enqueue_detach_on(std::size_t worker, Affinity affinity, F &&f, Args &&...args) {
+        // Cleaner error message than concept
+        static_assert(std::is_same_v<void, std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>>,
+                      "Function must return void.");
+
+        execute_on(worker, affinity, detail::bind(std::forward<F>(f), std::forward<Args>(args)...));
+    }
+
+    // The worker tasks keyed by `key` should be submitted to, for `enqueue_on`. Equal keys map to the same
+    // worker for as long as the pool is not resized.
+    template <typename Key> std::size_t worker_for(Key const &key) const noexcept {
+        // Fibonacci hashing spreads the low quality hashes of e.g. integers over all of the bits.
+        std::uint64_t mixed = static_cast<std::uint64_t>(std::hash<Key>{}(key)) * 0x9E3779B97F4A7C15;
+        return static_cast<std::size_t>(((mixed >> 32) * size()) >> 32);
+    }
+
+    // Push a ready-made `task` into the pool, the way to submit a single task to a pool of concrete tasks.
+    void push(task_type task, Priority priority = Priority::normal) { execute(std::move(task), priority); }
+
+    // As `push` but returns false, without queueing `task`, if the queue it would go on is full.
+    [[nodiscard]] bool try_push(task_type task) { return execute(std::move(task), Priority::normal, true); }
+
+    // As `push` but for worker `worker % size()`, see `enqueue_on`.
+    void push_on(std::size_t worker, task_type task, Affinity affinity = Affinity::preferred) {
+        execute_on(worker, affinity, std::move(task));
+    }
+
+    // Enqueue every callable in `[first, last)` into the threadpool, they are copied (use
+    // `std::move_iterator` to move them) and must be nullary and return void. Much cheaper than repeated
+    // calls to `enqueue_detach` as tasks are pushed in chunks and each worker is signalled at most once.
+    template <std::input_iterator I, std::sentinel_for<I> S> void enqueue_bulk(I first, S last) {
+        // Cleaner error message than concept
+        static_assert(std::is_same_v<void, std::invoke_result_t<std::decay_t<std::iter_reference_t<I>>>>,
+                      "Function must return void.");
+
+        execute_bulk([&](task_t &slot) {
+            if (first == last) {
+                return false;
+            }
+            slot = wrap(*first);
+            ++first;
+            return true;
+        });
+    }
+
+    // Enqueue `n` tasks into the threadpool, the i'th task is the nullary, void-returning, callable returned
+    // by `gen(i)`. The generator is called on the calling thread, see `enqueue_bulk(first, last)`.
+    template <typename G>
+    requires std::invocable<G &, std::size_t>
+    void enqueue_bulk(std::size_t n, G &&gen) {
+        // Cleaner error message than concept
+        static_assert(std::is_same_v<void, std::invoke_result_t<std::invoke_result_t<G &, std::size_t>>>,
+                      "Function must return void.");
+
+        std::size_t i = 0;
+
+        execute_bulk([&](task_t &slot) {
+            if (i == n) {
+                return false;
+            }
+            slot = wrap(std::invoke(gen, i++));
+            return true;
+        });
+    }
+
+    // Enqueue `n` tasks, the i'th calls `f(i)`, behind a single `riften::Batch` handle. Costs one allocation
+    // (the shared state, which holds `f`) for the whole batch rather than one future per task, and the tasks
+    // are pushed as by `enqueue_bulk`. `f` is shared by the tasks and may thus be called concurrently. If a
+    // task throws, tasks which have not yet started are skipped and `Batch::get` rethrows the exception. A
+    // task discarded before it runs (see `cancel_pending`) fails the batch with a broken promise.
+    template <typename F>
+    requires erased && std::invocable<std::decay_t<F> &, std::size_t>
+    [[nodiscard]] Batch enqueue_n(std::size_t n, F &&f) {
+        auto *state = new detail::BatchOf<std::decay_t<F>>(n, std::forward<F>(f));
+
+        Batch batch(state);
+
+        enqueue_bulk(n, [state](std::size_t i) {
+            return detail::Discardable([state, i]() noexcept { state->run(i); },
+                                       [state]() noexcept { state->discard(); });
+        });
+
+        state->join.done();  // The submitter's count, so an empty batch is ready too.
+
+        return batch;
+    }
+
+    // Enqueue callable `f` into the threadpool once `when` has passed, see `enqueue`. No thread sleeps per
+    // timer: the next deadline is tracked by a worker that parks with a timeout (or by busy workers between
+    // tasks) and due tasks are scheduled like any other. Timers that are not due when the pool is destroyed
+    // are discarded, their futures report a broken promise.
+    template <typename Duration, typename... Args, typename F>
+    requires erased
+    [[nodiscard]] Future<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>> enqueue_at(
+        std::chrono::time_point<clock, Duration> when,
+        F &&f,
+        Args &&...args) {
+        //
+        auto task = detail::NullaryOneShot(detail::bind(std::forward<F>(f), std::forward<Args>(args)...));
+
+        auto future = task.get_future(this);
+
+        add_timer(std::chrono::time_point_cast<clock::duration>(when), std::move(task));
+
+        return future;
+    }
+
+    // Enqueue callable `f` into the threadpool after `delay`, see `enqueue_at`.
+    template <typename Rep, typename Period, typename... Args, typename F>
+    requires erased
+    [[nodiscard]] Future<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>> enqueue_after(
+        std::chrono::duration<Rep, Period> delay,
+        F &&f,
+        Args &&...args) {
+        //
+        return enqueue_at(clock::now() + delay, std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    // Call `f()` every `period`, starting one period from now, until it returns false (if it returns bool) or
+    // the pool is destroyed. Calls never overlap: a late call delays the next. Like `enqueue_detach`, `f`
+    // must not throw.
+    template <typename Rep, typename Period, typename F>
+    requires erased && std::invocable<std::decay_t<F> &>
+    void enqueue_every(std::chrono::duration<Rep, Period> period, F &&f) {
+        struct Periodic {
+            BasicThiefpool *pool;
+            time_point when;
+            clock::duration period;
+            std::decay_t<F> fn;
+
+            void operator()() && {
+                if constexpr (std::is_same_v<bool, std::invoke_result_t<std::decay_t<F> &>>) {
+                    if (!std::invoke(fn)) {
+                        return;
+                    }
+                } else {
+                    std::invoke(fn);
+                }
+                when = std::max(when + period, clock::now());
+                pool->add_timer(when, detail::make_task(std::move(*this)));
+            }
+        };
+
+        auto step = std::chrono::duration_cast<clock::duration>(period);
+        auto first = clock::now() + step;
+
+        add_timer(first, detail::make_task(Periodic{this, first, step, std::forward<F>(f)}));
+    }
+
+    // Enqueue callable `f` into the threadpool once file descriptor `fd` is ready for `events` (`EPOLLIN`,
+    // `EPOLLOUT`, ...), see `enqueue`. Linux only, elsewhere this throws `std::system_error`. There is no I/O
+    // thread: one idle worker at a time sleeps in `epoll_wait` instead of parking, submissions wake it
+    // through an eventfd, and the tasks of ready descriptors go straight onto its deque. A descriptor may
+    // have one pending wait, which fires once: wait again for more, a second wait on the same descriptor
+    // throws `std::system_error` (`EEXIST`). Do not close `fd` while it has a pending wait, `cancel_ready`
+    // it first. Waits still pending when the pool is destroyed are discarded, their futures report a broken
+    // promise.
+    template <typename... Args, typename F>
+    requires erased
+    [[nodiscard]] Future<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>> enqueue_ready(
+        int fd,
+        std::uint32_t events,
+        F &&f,
+        Args &&...args) {
+        //
+        auto task = detail::NullaryOneShot(detail::bind(std::forward<F>(f), std::forward<Args>(args)...));
+
+        auto future = task.get_future(this);
+
+        add_io_wait(fd, events, std::move(task));
+
+        return future;
+    }
+
+    // Discard the pending wait on `fd`, if any, its future reports a broken promise. Returns false if there
+    // was none, e.g. because `fd` became ready first.
+    bool cancel_ready(int fd) requires erased {
+        detail::task discarded;  // Destroyed outside the lock.
+
+        std::scoped_lock lock(_io_mutex);
+
+        auto it = _io_waits.find(fd);
+
+        if (it == _io_waits.end()) {
+            return false;
+        }
+
+        discarded = std::move(it->second);
+        _io_waits.erase(it);
+        _reactor->disarm(fd);
+        _io_pending.fetch_sub(1, seq_cst);
+
+        return true;
+    }
+
+    // Returns an awaitable which, when `co_await`ed, suspends the calling coroutine and resumes it on one of
+    // the pool's workers. No allocation is made, the task is just the coroutine's handle. A suspended
+    // coroutine cannot be discarded: if the pool drops the task the coroutine is resumed there and then.
+    [[nodiscard]] auto schedule() noexcept requires erased {
+        struct Awaitable {
+            BasicThiefpool *pool;
+
+            bool await_ready() const noexcept { return false; }
+
+            void await_suspend(std::coroutine_handle<> handle) {
+                pool->execute(detail::Discardable([handle]() { handle.resume(); },
+                                                  [handle]() noexcept { handle.resume(); }));
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+        return Awaitable{this};
+    }
+
+    // Block until `future` is ready. If called by one of our workers (e.g. a task waiting on a task it
+    // enqueued) the worker keeps running queued and stolen tasks until then, instead of sleeping, so nested
+    // waits can neither deadlock the pool nor leave a core idle.
+    template <typename T>
+    requires erased
+    void wait(Future<T> const &future) {
+        if (detail::this_worker.pool == this) {
+            help_until([&] { return future.is_ready(); });
+        } else {
+            future.wait();
+        }
+    }
+
+    // As above, for a whole `batch`.
+    void wait(Batch const &batch) requires erased {
+        if (detail::this_worker.pool == this) {
+            help_until([&] { return batch.is_ready(); });
+        } else {
+            batch.wait();
+        }
+    }
+
+    // True if every task submitted so far, and every task they submitted, has finished. Timers that are not
+    // yet due do not count. Only a snapshot: any thread may submit more work right after.
+    bool is_idle() const noexcept {
+        // Completions first, each one we see makes its task's submission visible, see `count`.
+        std::uint64_t done = _outside_completed.load(acquire);
+        for (named_pair const &d : _deques) {
+            done += d.completed.load(acquire);
+        }
+
+        std::uint64_t sent = _outside_submitted.load(acquire);
+        for (named_pair const &d : _deques) {
+            sent += d.submitted.load(acquire);
+        }
+
+        return done == sent;
+    }
+
+    // Block until `is_idle()`, running tasks from the injector on the calling thread in the meantime. The
+    // pool stays usable, e.g. to wait between the phases of a job instead of destroying the pool. Must not
+    // be called from a task as that task would never finish.
+    void wait_idle() {
+        assert(detail::this_worker.pool != this && "Waiting for the pool to be idle from inside a task.");
+
+        while (!is_idle()) {
+            std::optional<task_t> one_shot;
+
+            for (std::size_t lane = 0; lane < lanes && !one_shot; ++lane) {
+                one_shot = _injector[lane].pop();
+            }
+
+            if (one_shot) {
+                std::invoke(std::move(*one_shot));
+                _outside_completed.fetch_add(1, release);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // Discard every task which has not started yet, returns how many. Their futures report a broken promise,
+    // as do the `TaskGroup`, `TaskGraph`, `Batch` or parallel algorithm they belong to, and their destructors
+    // run on the calling thread once every queue is empty. A coroutine suspended in `schedule()` is resumed
+    // on the calling thread instead. Tasks already running (and what they go on to submit) are unaffected.
+    std::size_t cancel_pending() {
+        std::vector<task_t> discarded;
+
+        auto take = [&](std::optional<task_t> &&one_shot) {
+            if (one_shot) {
+                discarded.push_back(std::move(*one_shot));
+            }
+            return one_shot.has_value();
+        };
+
+        for (std::size_t lane = 0; lane < lanes; ++lane) {
+            while (take(_injector[lane].pop())) {
+            }
+            for (named_pair &d : _deques) {
+                while (lane == normal && (take(d.pinned.pop()) || take(d.inbox.pop()))) {
+                }
+                // A steal can lose a race with the owner, keep going until the deque is empty.
+                while (!d.tasks[lane].empty()) {
+                    take(d.tasks[lane].steal());
+                }
+            }
+        }
+
+        _outside_completed.fetch_add(discarded.size(), release);
+
+        std::size_t n = discarded.size();
+
+        discarded.clear();  // Only now as discarding may submit more tasks, e.g. a resumed coroutine.
+
+        return n;
+    }
+
+    // End a phase of work without destroying the pool: optionally `cancel_pending()` then `wait_idle()`.
+    void shutdown(Shutdown mode = Shutdown::drain) {
+        if (mode == Shutdown::cancel) {
+            cancel_pending();
+        }
+        wait_idle();
+    }
+
+    // Sum of the idle statistics of every worker, relaxed counters so only approximate while running.
+    IdleStats idle_stats() const noexcept {
+        IdleStats total;
+        for (named_pair const &d : _deques) {
+            total.spins += d.spins.load(relaxed);
+            total.yields += d.yields.load(relaxed);
+            total.parks += d.parks.load(relaxed);
+        }
+        return total;
+    }
+
+    // Read every worker's counters, e.g. to export them to a monitoring system. Relaxed loads so the view
+    // is only approximately consistent while the pool is running.
+    PoolStats snapshot() const {
+        using detail::Stat;
+
+        PoolStats stats;
+
+        for (named_pair const &d : _deques) {
+            WorkerStats w;
+
+            w.executed = d.stats.get(Stat::executed);
+            w.local = d.stats.get(Stat::local);
+            w.injected = d.stats.get(Stat::injected);
+            w.stolen = d.stats.get(Stat::stolen);
+            w.failed_steals = d.stats.get(Stat::failed_steals);
+            w.spins = d.spins.load(relaxed);
+            w.yields = d.yields.load(relaxed);
+            w.parks = d.parks.load(relaxed);
+            w.wakeups = d.stats.get(Stat::wakeups);
+            w.idle_ns = d.stats.get(Stat::idle_ns);
+            w.parked_ns = d.stats.get(Stat::parked_ns);
+            w.high_water = d.stats.get(Stat::high_water);
+
+            WorkerStats &t = stats.total;
+
+            t.executed += w.executed;
+            t.local += w.local;
+            t.injected += w.injected;
+            t.stolen += w.stolen;
+            t.failed_steals += w.failed_steals;
+            t.spins += w.spins;
+            t.yields += w.yields;
+            t.parks += w.parks;
+            t.wakeups += w.wakeups;
+            t.idle_ns += w.idle_ns;
+            t.parked_ns += w.parked_ns;
+            t.high_water = std::max(t.high_water, w.high_water);
+
+            stats.workers.push_back(w);
+        }
+
+        return stats;
+    }
+
+    // Write the most recent events of every worker, if `RIFTEN_THIEFPOOL_TRACE` is defined, as a Chrome
+    // `trace_event` JSON file which chrome://tracing and Perfetto can open. Each worker keeps its recent
+    // events in a lock-free ring of `RIFTEN_THIEFPOOL_TRACE_CAPACITY` slots, so this may be called any time.
+    void write_trace(std::ostream &out) const {
+        std::vector<std::vector<TraceEvent>> threads;
+        std::vector<std::string> names;
+
+        for (std::size_t id = 0; id < _deques.size(); ++id) {
+            threads.push_back(_deques[id].trace.events());
+            names.push_back("worker " + std::to_string(id));
+        }
+
+        threads.push_back(_outside_trace.events());
+        names.push_back("outside");
+
+        detail::write_chrome_trace(out, threads, names);
+    }
+
+    // Number of workers currently running tasks, see `resize`.
+    std::size_t size() const noexcept { return _active.load(relaxed); }
+
+    // Number of worker threads in the pool, the most `resize` can grow it to.
+    std::size_t capacity() const noexcept { return _deques.size(); }
+
+    // Change the number of workers running tasks to `n`, clamped to `[1, capacity()]`. Retired workers
+    // finish the tasks already on their own deques, which others may also steal, and then sleep until the
+    // pool grows again. No threads are created or joined so a grown pool is warm immediately.
+    void resize(std::size_t n) {
+        n = std::clamp<std::size_t>(n, 1, _deques.size());
+
+        std::size_t old = _active.exchange(n, seq_cst);
+
+        std::atomic_thread_fence(seq_cst);  // Pairs with the fence in `park`.
+
+        for (std::size_t id = old; id < n; ++id) {
+            wake_worker(id);
+        }
+    }
+
+    // A process-wide pool with a worker per hardware thread, created on first use. Share it rather than
+    // building short-lived pools, see `riften::Arena` to group and wait for tasks submitted to it.
+    static BasicThiefpool &shared() {
+        static BasicThiefpool pool(std::max(1u, std::thread::hardware_concurrency()));
+        return pool;
+    }
+
+    // The workers finish every queued task before they exit. Timers and I/O waits still pending are then
+    // discarded and whatever that submits (e.g. continuations of their futures) runs on the calling thread,
+    // before any member is destroyed.
+    ~BasicThiefpool() {
+        for (auto &t : _threads) {
+            t.request_stop();
+        }
+        std::atomic_thread_fence(seq_cst);  // Pairs with the fence in `park`.
+        wake(_deques.size(), true);
+
+        for (auto &t : _threads) {
+            t.join();
+        }
+
+        _backpressure.capacity = SIZE_MAX;  // Nothing would make room for this thread's submissions.
+
+        while (discard_waits() || run_leftovers()) {
+        }
+    }
+
+  private:
+    friend struct detail::PoolAccess;
+
+    // Continuations of our futures are scheduled like any other task, by `execute`, and therefore land on
+    // the deque of the worker that completed the future.
+    friend struct detail::SchedulerFor<BasicThiefpool, Task>;
+
+    using task_t = Task;
+
+    // Convert a callable to what the deques store, only type-erased tasks can be anything else.
+    template <typename F> static task_t wrap(F &&f) {
+        if constexpr (erased) {
+            return detail::make_task(std::forward<F>(f));
+        } else {
+            return task_t(std::forward<F>(f));
+        }
+    }
+
+    // Fire and forget interface. Tasks submitted by one of our own workers are pushed onto that worker's
+    // deque, other threads push into the injector queue. Either way a parked worker is woken to run (or
+    // steal) the task, unless some worker is already searching for work.
+    //
+    // If the queue is full the task is handled according to `_backpressure`, or if `try_only` nothing is
+    // done and false returned (`f` is left untouched). Returns true otherwise, even if the task ran inline.
+    template <std::invocable F>
+    bool execute(F &&f, Priority priority = Priority::normal, bool try_only = false) {
+        auto lane = static_cast<std::size_t>(priority);
+
+        if (detail::this_worker.pool == this) {
+            std::size_t id = detail::this_worker.id;
+            named_pair &self = _deques[id];
+            if (full(self.tasks[lane]) && (try_only || !make_room(self.tasks[lane], id))) {
+                return run_instead(std::forward<F>(f), try_only);
+            }
+            count(self.submitted);
+            self.tasks[lane].emplace(wrap(std::forward<F>(f)));
+            self.stats.raise(detail::Stat::high_water, self.tasks[lane].size());
+            self.trace.record(TraceEvent::enqueue, 1);
+        } else {
+            if (full(_injector[lane]) && (try_only || !make_room(_injector[lane], true))) {
+                return run_instead(std::forward<F>(f), try_only);
+            }
+            _outside_submitted.fetch_add(1, release);
+            _injector[lane].emplace(wrap(std::forward<F>(f)));
+            _outside_trace.record_shared(TraceEvent::enqueue, 1);
+        }
+        wake();
+        return true;
+    }
+
+    // As `execute` but into the inbox of worker `worker % size()`, which is then woken if it is parked.
+    template <std::invocable F> void execute_on(std::size_t worker, Affinity affinity, F &&f) {
+        std::size_t id = worker % size();
+
+        Queue<task_t> &inbox = affinity == Affinity::pinned ? _deques[id].pinned : _deques[id].inbox;
+
+        // Running a pinned task anywhere else would break the pinning, it is queued anyway.
+        if (full(inbox) && !make_room(inbox, affinity != Affinity::pinned)) {
+            run_instead(std::forward<F>(f), false);
+            return;
+        }
+
+        if (detail::this_worker.pool == this) {
+            named_pair &self = _deques[detail::this_worker.id];
+            count(self.submitted);
+            inbox.emplace(wrap(std::forward<F>(f)));
+            self.trace.record(TraceEvent::enqueue, 1);
+        } else {
+            _outside_submitted.fetch_add(1, release);
+            inbox.emplace(wrap(std::forward<F>(f)));
+            _outside_trace.record_shared(TraceEvent::enqueue, 1);
+        }
+        wake_worker(id);
+    }
+
+    // Bulk fire and forget interface, `next(slot)` fills `slot` with the next task or returns false.
+    // External submissions are pushed into the injector in chunks. Each chunk wakes enough parked workers
+    // that there is one awake and searching per new task.
+    template <typename G> void execute_bulk(G &&next) {
+        if (detail::this_worker.pool == this) {
+            std::size_t n = 0;
+            named_pair &self = _deques[detail::this_worker.id];
+            for (task_t one_shot; next(one_shot);) {
+                if (full(self.tasks[normal]) && !make_room(self.tasks[normal], detail::this_worker.id)) {
+                    std::invoke(std::move(one_shot));
+                    continue;
+                }
+                count(self.submitted);
+                self.tasks[normal].emplace(std::move(one_shot));
+                ++n;
+            }
+            self.stats.raise(detail::Stat::high_water, self.tasks[normal].size());
+            self.trace.record(TraceEvent::enqueue, n);
+            wake(n);
+            return;
+        }
+
+        std::array<task_t, injector_batch> chunk;
+
+        for (bool more = true; more;) {
+            std::size_t n = 0;
+
+            while (n < chunk.size() && (more = next(chunk[n]))) {
+                ++n;
+            }
+
+            if (full(_injector[normal]) && !make_room(_injector[normal], true)) {
+                for (std::size_t i = 0; i < n; ++i) {
+                    std::invoke(std::move(chunk[i]));
+                }
+                continue;
+            }
+
+            _outside_submitted.fetch_add(n, release);
+            _injector[normal].push_bulk(chunk.data(), n);
+            _outside_trace.record_shared(TraceEvent::enqueue, n);
+
+            wake(n);
+        }
+    }
+
+    // True if `queue` holds as many tasks as `_backpressure` allows.
+    template <typename Q> bool full(Q const &queue) const noexcept {
+        return _backpressure.capacity != SIZE_MAX && queue.size() >= _backpressure.capacity;
+    }
+
+    // Make room in the full deque of the calling worker `id`, returns false if the task should be run inline
+    // instead. A worker never waits for its own deque to drain.
+    bool make_room(Deque<task_t> &deque, std::size_t id) {
+        if (_backpressure.overflow == Overflow::drop_oldest) {
+            if (std::optional dropped = deque.steal()) {
+                count(_deques[id].completed);
+            }  // Discarding it may submit more tasks, e.g. a resumed coroutine.
+            return true;
+        }
+        return false;
+    }
+
+    // Make room in the full `queue`, returns false if the task should be run inline instead (only if
+    // `may_inline`). Workers (which may be the ones that would make room) do not block.
+    bool make_room(Queue<task_t> &queue, bool may_inline) {
+        bool worker = detail::this_worker.pool == this;
+
+        switch (_backpressure.overflow) {
+            case Overflow::drop_oldest:
+                if (queue.pop()) {
+                    if (worker) {
+                        count(_deques[detail::this_worker.id].completed);
+                    } else {
+                        _outside_completed.fetch_add(1, release);
+                    }
+                }
+                return true;
+            case Overflow::block:
+                if (!worker) {
+                    while (full(queue)) {
+                        std::this_thread::yield();
+                    }
+                    return true;
+                }
+                return !may_inline;
+            case Overflow::run_inline:
+                return !may_inline;
+        }
+        return true;
+    }
+
+    // Run `f` on the calling thread in place of queueing it, unless `try_only`. Returns `!try_only`.
+    template <typename F> static bool run_instead(F &&f, bool try_only) {
+        if (try_only) {
+            return false;
+        }
+        std::invoke(std::forward<F>(f));
+        return true;
+    }
+
+    // Wake up to `n` parked workers, fewer if some are already searching for work (unless `all`). A worker
+    // is woken at most once per park and is counted as searching from the moment it is chosen, so a burst
+    // of submissions wakes one worker per task rather than one per submission. Call after making a task
+    // visible.
+    void wake(std::size_t n = 1, bool all = false) noexcept {
+        std::atomic_thread_fence(seq_cst);  // Pairs with the fence in `park`.
+
+        if (!all) {
+            std::size_t searching = _searching.load(relaxed);
+            n = n > searching ? n - searching : 0;
+        }
+
+        std::size_t active = all ? _deques.size() : _active.load(relaxed);
+
+        for (std::size_t w = 0; w * 64 < active && n > 0; ++w) {
+            // Never wake workers retired by `resize`.
+            std::uint64_t live = active - w * 64 >= 64 ? ~std::uint64_t{0}
+                                                        : (std::uint64_t{1} << (active - w * 64)) - 1;
+
+            for (std::uint64_t bits = _parked[w].load(relaxed) & live; bits != 0 && n > 0;) {
+                std::uint64_t bit = bits & (~bits + 1);
+
+                if (_parked[w].fetch_and(~bit, acq_rel) & bit) {
+                    _searching.fetch_add(1, seq_cst);
+                    unpark(w * 64 + static_cast<std::size_t>(std::countr_zero(bit)));
+                    --n;
+                }
+
+                bits = _parked[w].load(relaxed) & live;
+            }
+        }
+    }
+
+    // Wake worker `id` if it is parked, even if it is retired, e.g. because only it may run a task.
+    void wake_worker(std::size_t id) noexcept {
+        std::atomic_thread_fence(seq_cst);  // Pairs with the fence in `park`.
+
+        std::uint64_t bit = std::uint64_t{1} << (id % 64);
+
+        if (_parked[id / 64].fetch_and(~bit, acq_rel) & bit) {
+            _searching.fetch_add(1, seq_cst);
+            unpark(id);
+        }
+    }
+
+    // Wake worker `id` whose parked bit the caller just cleared, through the reactor if it is the poller.
+    // The semaphore is released regardless in case the worker is yet to become the poller, see `park`.
+    void unpark(std::size_t id) noexcept {
+        _deques[id].sem.release();
+
+        if constexpr (erased) {
+            if (_poller.load(seq_cst) == id) {
+                _reactor->notify();
+            }
+        }
+    }
+
+    // Mark worker `id` as parked and sleep until woken. Returns immediately if the pool is stopping or there
+    // is work queued anywhere (e.g. a task was submitted right after we gave up). Either way we return
+    // unparked and counted as searching.
+    //
+    // If timers are pending and no other worker is driving them, this worker becomes the timer driver: it
+    // parks only until the next deadline and then fires the due timers. Likewise if file descriptors are
+    // being waited on and no other worker is polling them this worker becomes the poller: it sleeps in the
+    // reactor instead of on its semaphore and schedules the tasks of ready descriptors on its own deque.
+    void park(std::size_t id, std::stop_token const &tok) {
+        std::atomic<std::uint64_t> &word = _parked[id / 64];
+        std::uint64_t bit = std::uint64_t{1} << (id % 64);
+
+        word.fetch_or(bit, seq_cst);
+
+        std::atomic_thread_fence(seq_cst);  // Pairs with the fence in `wake`.
+
+        bool driver = false;
+        bool poller = false;
+
+        std::vector<detail::task> ready;  // Of the file descriptors that became ready while we polled.
+
+        detail::Counters &stats = _deques[id].stats;
+
+        bool retired = id >= _active.load(seq_cst);
+
+        if (!tok.stop_requested() && (retired ? !has_mail(id) : !work_available(id))) {
+            _deques[id].trace.record(TraceEvent::park);
+            std::uint64_t since = stats.now();
+            std::size_t none = no_driver;
+
+            if (erased && !retired && _next_timer.load(seq_cst) != no_timer
+                && _driver.compare_exchange_strong(none, id, seq_cst)) {
+                driver = true;
+            }
+
+            none = no_driver;
+
+            if (erased && !retired && _io_pending.load(seq_cst) > 0
+                && _poller.compare_exchange_strong(none, id, seq_cst)) {
+                poller = true;
+            }
+
+            auto deadline = time_point(clock::duration(_next_timer.load(seq_cst)));
+
+            if constexpr (erased) {
+                // A waker that cleared our bit before seeing us as the poller only released the semaphore.
+                if (poller && (word.load(seq_cst) & bit)) {
+                    ready = poll_io(driver ? std::optional(deadline) : std::nullopt);
+                }
+            }
+
+            if (poller) {
+                _deques[id].sem.try_acquire_many();  // A wake-up meant for the semaphore, we are awake now.
+            } else if (driver) {
+                _deques[id].sem.try_acquire_many_until(deadline);
+            } else {
+                _deques[id].sem.acquire_many(0);
+            }
+            stats.add(detail::Stat::parked_ns, stats.now() - since);
+            _deques[id].trace.record(TraceEvent::unpark);
+        }
+
+        // Unpark ourselves, unless a waker already did so and counted us as searching.
+        if (word.fetch_and(~bit, acq_rel) & bit) {
+            _searching.fetch_add(1, seq_cst);
+        } else {
+            stats.add(detail::Stat::wakeups);
+        }
+
+        if constexpr (erased) {
+            if (poller) {
+                _poller.store(no_driver, seq_cst);
+
+                std::size_t k = 0;
+
+                execute_bulk([&](task_t &slot) {
+                    if (k == ready.size()) {
+                        return false;
+                    }
+                    slot = std::move(ready[k++]);
+                    return true;
+                });
+            }
+            if (driver) {
+                fire_timers();
+                _driver.store(no_driver, seq_cst);
+            }
+        }
+    }
+
+    // Discard every pending timer and I/O wait, returns false if there were none. Only once the workers have
+    // exited: the tasks are destroyed after the locks are released as that may submit more.
+    bool discard_waits() {
+        std::vector<Timer> timers;
+        std::unordered_map<int, detail::task> waits;
+
+        std::scoped_lock lock(_timer_mutex, _io_mutex);
+
+        timers.swap(_timers);
+        waits.swap(_io_waits);
+        _next_timer.store(no_timer, seq_cst);
+        _io_pending.store(0, seq_cst);
+
+        return !timers.empty() || !waits.empty();
+    }
+
+    // Run every task left in the injectors, deques and inboxes on the calling thread, returns false if there
+    // were none. Only once the workers have exited.
+    bool run_leftovers() {
+        bool ran = false;
+
+        auto run = [&](std::optional<task_t> &&one_shot) {
+            if (one_shot) {
+                std::invoke(std::move(*one_shot));
+                ran = true;
+            }
+            return one_shot.has_value();
+        };
+
+        for (std::size_t lane = 0; lane < lanes; ++lane) {
+            while (run(_injector[lane].pop())) {
+            }
+            for (named_pair &d : _deques) {
+                while (lane == normal && (run(d.pinned.pop()) || run(d.inbox.pop()))) {
+                }
+                while (run(d.tasks[lane].steal())) {
+                }
+            }
+        }
+
+        return ran;
+    }
+
+    // Arm the reactor, created on first use, to run `task` once `fd` is ready for `events`.
+    void add_io_wait(int fd, std::uint32_t events, detail::task &&task) {
+        {
+            std::scoped_lock lock(_io_mutex);
+
+            if (!_reactor) {
+                _reactor = std::make_unique<detail::Reactor>();
+            }
+
+            auto [it, fresh] = _io_waits.try_emplace(fd, std::move(task));
+
+            if (!fresh) {
+                throw std::system_error(EEXIST, std::system_category(), "riften: fd has a pending wait");
+            }
+
+            try {
+                _reactor->arm(fd, events);
+            } catch (...) {
+                _io_waits.erase(it);
+                throw;
+            }
+
+            _io_pending.fetch_add(1, seq_cst);
+        }
+
+        if (_poller.load(seq_cst) == no_driver) {
+            wake();  // The next worker to park becomes the poller.
+        }
+    }
+
+    // Sleep in the reactor until a file descriptor is ready, we are woken or `deadline` passes, returns the
+    // tasks waiting on the ready descriptors. Only call as the poller.
+    std::vector<detail::task> poll_io(std::optional<time_point> deadline) {
+        int timeout = -1;
+
+        if (deadline) {
+            auto left = std::chrono::ceil<std::chrono::milliseconds>(*deadline - clock::now());
+            timeout = static_cast<int>(std::clamp<std::int64_t>(left.count(), 0, INT_MAX));
+        }
+
+        std::vector<int> fds = _reactor->wait(timeout);
+
+        std::vector<detail::task> ready;
+
+        std::scoped_lock lock(_io_mutex);
+
+        for (int fd : fds) {
+            if (auto it = _io_waits.find(fd); it != _io_waits.end()) {
+                ready.push_back(std::move(it->second));
+                _io_waits.erase(it);
+                _io_pending.fetch_sub(1, seq_cst);
+            }
+        }
+
+        return ready;
+    }
+
+    // Add a task to run once `when` has passed, wakes the timer driver if the next deadline moved earlier.
+    void add_timer(time_point when, detail::task &&task) {
+        bool earliest = false;
+        {
+            std::scoped_lock lock(_timer_mutex);
+
+            _timers.push_back({when, _timer_seq++, std::move(task)});
+            std::push_heap(_timers.begin(), _timers.end(), std::greater<>{});
+
+            if (_timers.front().seq + 1 == _timer_seq) {
+                earliest = true;
+                _next_timer.store(when.time_since_epoch().count(), seq_cst);
+            }
+        }
+
+        if (earliest) {
+            if (std::size_t driver = _driver.load(seq_cst); driver != no_driver) {
+                unpark(driver);  // Re-arm at the new deadline.
+            } else {
+                wake();  // The next worker to park becomes the driver.
+            }
+        }
+    }
+
+    // Run due timers if no other worker is driving them, cheap when no timers are pending.
+    void poll_timers() {
+        std::int64_t next = _next_timer.load(relaxed);
+
+        if (next == no_timer || clock::now().time_since_epoch().count() < next) {
+            return;
+        }
+
+        std::size_t none = no_driver;
+
+        if (_driver.compare_exchange_strong(none, detail::this_worker.id, seq_cst)) {
+            fire_timers();
+            _driver.store(no_driver, seq_cst);
+        }
+    }
+
+    // Move every due timer's task into the pool, only call as the timer driver.
+    void fire_timers() {
+        std::vector<detail::task> due;
+        {
+            std::scoped_lock lock(_timer_mutex);
+
+            auto now = clock::now();
+
+            while (!_timers.empty() && _timers.front().when <= now) {
+                std::pop_heap(_timers.begin(), _timers.end(), std::greater<>{});
+                due.push_back(std::move(_timers.back().task));
+                _timers.pop_back();
+            }
+
+            _next_timer.store(_timers.empty() ? no_timer : _timers.front().when.time_since_epoch().count(),
+                              seq_cst);
+        }
+
+        for (detail::task &task : due) {
+            execute(std::move(task));
+        }
+    }
+
+    // Keep running tasks on the calling worker until `done()` returns true, must be called by a worker.
+    template <std::predicate Pred> void help_until(Pred &&done) {
+        while (!done()) {
+            if (std::optional one_shot = find_task(detail::this_worker.id, false)) {
+                named_pair &self = _deques[detail::this_worker.id];
+                self.trace.record(TraceEvent::begin);
+                std::invoke(std::move(*one_shot));
+                self.trace.record(TraceEvent::end);
+                count(self.completed);
+                self.stats.add(detail::Stat::executed);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // Find a task for worker `id`, priority by priority: LIFO from its own deque then a batch from the
+    // injector. Then (unless `local_only`) try to steal, again in priority order, from a random victim in
+    // each tier of victims, nearest first. Lower priorities are only looked at if the higher ones are empty.
+    std::optional<task_t> find_task(std::size_t id, bool local_only) {
+        for (std::size_t lane = 0; lane < lanes; ++lane) {
+            if (std::optional one_shot = _deques[id].tasks[lane].pop()) {
+                _deques[id].stats.add(detail::Stat::local);
+                return one_shot;
+            }
+            if (lane == normal) {
+                if (std::optional one_shot = pop_mail(id)) {
+                    _deques[id].stats.add(detail::Stat::local);
+                    return one_shot;
+                }
+            }
+            if (std::optional one_shot = drain_injector(id, lane)) {
+                return one_shot;
+            }
+        }
+
+        if (local_only) {
+            return std::nullopt;
+        }
+
+        std::array<std::size_t, 4> picks;
+        std::vector<std::vector<std::size_t>> const &tiers = _deques[id].victims;
+
+        for (std::size_t i = 0; i < tiers.size(); ++i) {
+            picks[i] = tiers[i][_deques[id].rng.bounded(static_cast<std::uint32_t>(tiers[i].size()))];
+        }
+
+        for (std::size_t lane = 0; lane < lanes; ++lane) {
+            for (std::size_t i = 0; i < tiers.size(); ++i) {
+                if (std::optional one_shot = steal_half(id, picks[i], lane)) {
+                    return one_shot;
+                }
+            }
+        }
+
+        // Only when there is nothing else to steal, take a task preferring another worker.
+        for (std::size_t i = 0; i < tiers.size(); ++i) {
+            if (std::optional one_shot = _deques[picks[i]].inbox.pop()) {
+                _deques[id].stats.add(detail::Stat::stolen);
+                return one_shot;
+            }
+        }
+        return std::nullopt;
+    }
+
+    // The highest priority task on worker `id`'s own deques, or else in its inboxes.
+    std::optional<task_t> pop_local(std::size_t id) {
+        for (std::size_t lane = 0; lane < lanes; ++lane) {
+            if (std::optional one_shot = _deques[id].tasks[lane].pop()) {
+                _deques[id].stats.add(detail::Stat::local);
+                return one_shot;
+            }
+        }
+        if (std::optional one_shot = pop_mail(id)) {
+            _deques[id].stats.add(detail::Stat::local);
+            return one_shot;
+        }
+        return std::nullopt;
+    }
+
+    // Steal the oldest task in `victim`'s `lane` for worker `id` and, if that succeeds, up to half of the
+    // victim's remaining tasks into our own deque. A burst of tasks on one worker thus spreads out in a few
+    // rounds of stealing and we do not have to pick a victim again for every task.
+    std::optional<task_t> steal_half(std::size_t id, std::size_t victim, std::size_t lane) {
+        Deque<task_t> &from = _deques[victim].tasks[lane];
+
+        Deque<task_t> &into = _deques[id].tasks[lane];
+        detail::Counters &stats = _deques[id].stats;
+
+        std::optional one_shot = from.steal();
+
+        if (!one_shot) {
+            stats.add(detail::Stat::failed_steals);
+            return one_shot;
+        }
+
+        std::uint64_t taken = 1;
+
+        for (std::size_t n = std::min(from.size() / 2, steal_batch); n > 0; --n, ++taken) {
+            if (std::optional extra = from.steal()) {
+                into.emplace(std::move(*extra));
+            } else {
+                break;
+            }
+        }
+
+        stats.add(detail::Stat::stolen, taken);
+        _deques[id].trace.record(TraceEvent::steal, victim);
+        stats.raise(detail::Stat::high_water, into.size());
+
+        return one_shot;
+    }
+
+    // Group every worker's potential victims into tiers of increasing distance given the CPUs the workers
+    // will be pinned to, or into a single tier if they are not pinned.
+    void plan_victims(std::vector<Cpu> const &cpus) {
+        for (std::size_t id = 0; id < _deques.size(); ++id) {
+            std::vector<std::vector<std::size_t>> tiers(cpus.empty() ? 1 : 4);
+
+            for (std::size_t victim = 0; victim < _deques.size(); ++victim) {
+                if (victim != id) {
+                    std::size_t far = cpus.empty() ? 0 : detail::distance(cpus[id % cpus.size()],
+                                                                          cpus[victim % cpus.size()]);
+                    tiers[far].push_back(victim);
+                }
+            }
+
+            std::erase_if(tiers, [](auto const &tier) { return tier.empty(); });
+
+            _deques[id].victims = std::move(tiers);
+        }
+    }
+
+    // Wait according to `_idle` after worker `id`'s `failed`'th consecutive search for a task came up empty,
+    // returns false if the worker should park.
+    bool back_off(std::size_t id, std::size_t failed) {
+        named_pair &self = _deques[id];
+
+        if (failed < _idle.spin_rounds) {
+            std::size_t pauses = std::min<std::size_t>(std::size_t{1} << std::min<std::size_t>(failed, 16),
+                                                       _idle.max_pause);
+
+            for (std::size_t i = 0; i < pauses; ++i) {
+                detail::cpu_relax();
+            }
+            bump(self.spins);
+            return true;
+        }
+
+        if (failed < _idle.spin_rounds + _idle.yield_rounds || work_available(id)) {
+            std::this_thread::yield();
+            bump(self.yields);
+            return true;
+        }
+
+        bump(self.parks);
+        return false;
+    }
+
+    // Increment a counter only ever written by its owning worker.
+    static void bump(std::atomic<std::uint64_t> &counter) noexcept {
+        counter.store(counter.load(relaxed) + 1, relaxed);
+    }
+
+    // As `bump`, but for the counters read by `is_idle`. Counting a completion with release semantics makes
+    // the submissions that happened before it visible to a reader that sees the completion.
+    static void count(std::atomic<std::uint64_t> &counter) noexcept {
+        counter.store(counter.load(relaxed) + 1, release);
+    }
+
+    // True if any task worker `id` could run is queued anywhere in the pool. Touches every worker's deque so
+    // it is only checked after repeatedly failing to find work, in place of a global in-flight counter.
+    bool work_available(std::size_t id) const noexcept {
+        auto has_any = [](auto const &queues) {
+            return std::any_of(queues.begin(), queues.end(), [](auto const &q) { return !q.empty(); });
+        };
+
+        return has_any(_injector) || has_mail(id)
+               || std::any_of(_deques.begin(), _deques.end(), [&](named_pair const &d) {
+                      return has_any(d.tasks) || !d.inbox.empty();
+                  });
+    }
+
+    // True if tasks were submitted to worker `id` with `enqueue_on`.
+    bool has_mail(std::size_t id) const noexcept {
+        return !_deques[id].pinned.empty() || !_deques[id].inbox.empty();
+    }
+
+    // The oldest task submitted to worker `id` with `enqueue_on`, pinned ones first.
+    std::optional<task_t> pop_mail(std::size_t id) {
+        if (std::optional one_shot = _deques[id].pinned.pop()) {
+            return one_shot;
+        }
+        return _deques[id].inbox.pop();
+    }
+
+    // Take a fair share of the `lane`'th injector's tasks, returns the first and pushes the rest onto our
+    // deque where other workers can steal them.
+    std::optional<task_t> drain_injector(std::size_t id, std::size_t lane) {
+        std::optional<task_t> one_shot;
+
+        Queue<task_t> &injector = _injector[lane];
+
+        if (injector.empty()) {
+            return one_shot;
+        }
+
+        std::size_t share = std::clamp<std::size_t>(injector.size() / _deques.size(), 1, injector_batch);
+
+        std::uint64_t taken = 0;
+
+        injector.pop_bulk(share, [&](task_t &&task) noexcept {
+            if (one_shot) {
+                _deques[id].tasks[lane].emplace(std::move(task));
+            } else {
+                one_shot.emplace(std::move(task));
+            }
+            ++taken;
+        });
+
+        _deques[id].stats.add(detail::Stat::injected, taken);
+        _deques[id].stats.raise(detail::Stat::high_water, _deques[id].tasks[lane].size());
+
+        return one_shot;
+    }
+
+    // Maximum number of tasks a worker moves from the injector to its deque in one go.
+    static constexpr std::size_t injector_batch = 32;
+
+    struct Timer {
+        time_point when;
+        std::uint64_t seq;  // Orders timers with the same deadline.
+        detail::task task;
+
+        friend bool operator>(Timer const &a, Timer const &b) noexcept {
+            return std::tie(a.when, a.seq) > std::tie(b.when, b.seq);
+        }
+    };
+
+    static constexpr std::int64_t no_timer = INT64_MAX;
+    static constexpr std::size_t no_driver = SIZE_MAX;
+
+    // Busy workers check for due timers every `timer_poll` tasks.
+    static constexpr std::size_t timer_poll = 64;
+
+    // Maximum number of extra tasks moved by one `steal_half`.
+    static constexpr std::size_t steal_batch = 32;
+
+    // One deque per priority per worker, and one injector per priority.
+    static constexpr std::size_t lanes = 3;
+    static constexpr std::size_t normal = static_cast<std::size_t>(Priority::normal);
+
+    struct alignas(detail::cache_line) named_pair {
+        Semaphore sem{0};
+        // Owned by the worker: pushed/popped LIFO by it, stolen FIFO by others.
+        std::array<Deque<task_t>, lanes> tasks;
+        Queue<task_t> inbox;   // Submitted to this worker with `Affinity::preferred`, may be stolen.
+        Queue<task_t> pinned;  // Submitted to this worker with `Affinity::pinned`, never stolen.
+        std::vector<std::vector<std::size_t>> victims;
+        Xoroshiro128StarStar rng{0};  // Only used by the worker, to pick victims.
+        std::atomic<std::uint64_t> spins = 0;
+        std::atomic<std::uint64_t> yields = 0;
+        std::atomic<std::uint64_t> parks = 0;
+        std::atomic<std::uint64_t> submitted = 0;  // Tasks this worker submitted.
+        std::atomic<std::uint64_t> completed = 0;  // Tasks this worker ran.
+        [[no_unique_address]] detail::Counters stats;
+        [[no_unique_address]] detail::TraceRing trace;
+    };
+
+    IdlePolicy _idle;
+    Backpressure _backpressure;
+    std::atomic<std::size_t> _active;  // Workers not retired by `resize`, ids [0, _active).
+    alignas(detail::cache_line) std::atomic<std::size_t> _searching = 0;  // Workers awake and without a task.
+    std::vector<std::atomic<std::uint64_t>> _parked;  // Bitmap of parked workers.
+    std::array<Queue<task_t>, lanes> _injector;  // Tasks submitted from outside the pool.
+    std::vector<named_pair> _deques;
+    alignas(detail::cache_line) std::atomic<std::uint64_t> _outside_submitted = 0;
+    std::atomic<std::uint64_t> _outside_completed = 0;  // Tasks run or discarded by non-workers.
+    [[no_unique_address]] detail::TraceRing _outside_trace;  // Submissions from outside the pool.
+
+    std::mutex _timer_mutex;
+    std::vector<Timer> _timers;  // Min-heap on deadline.
+    std::uint64_t _timer_seq = 0;
+    std::atomic<std::int64_t> _next_timer = no_timer;  // Earliest deadline in clock ticks.
+    std::atomic<std::size_t> _driver = no_driver;      // Worker responsible for firing timers.
+
+    std::mutex _io_mutex;
+    std::unique_ptr<detail::Reactor> _reactor;                // Created by the first `enqueue_ready`.
+    std::unordered_map<int, detail::task> _io_waits;          // Task to run once each descriptor is ready.
+    std::atomic<std::size_t> _io_pending = 0;                 // Size of `_io_waits`.
+    std::atomic<std::size_t> _poller = no_driver;             // Worker sleeping in the reactor.
+
+    std::vector<std::jthread> _threads;
+
+    static constexpr std::memory_order relaxed = std::memory_order_relaxed;
+    static constexpr std::memory_order acquire = std::memory_order_acquire;
+    static constexpr std::memory_order release = std::memory_order_release;
+    static constexpr std::memory_order acq_rel = std::memory_order_acq_rel;
+    static constexpr std::memory_order seq_cst = std::memory_order_seq_cst;
+};
+
+// The type-erased pool, runs any callable.
+using Thiefpool = BasicThiefpool<>;
+
+namespace detail {
+
+// Internals needed by the algorithms built on top of `Thiefpool`.
+struct PoolAccess {
+    static Scheduler *scheduler(Thiefpool &pool) noexcept { return &pool; }
+
+    // True if the calling thread is one of the `pool`'s workers.
+    static bool is_worker(Thiefpool const &pool) noexcept { return this_worker.pool == &pool; }
+
+    // True if the calling worker has no tasks queued in its deque, i.e. anything it pushes now is likely to
+    // be stolen by an idle worker. Always true on other threads, which may run `pool`'s tasks too: inline by
+    // `Overflow::run_inline` or in `wait_idle`, and have no deque of their own.
+    static bool local_empty(Thiefpool const &pool) noexcept {
+        if (!is_worker(pool)) {
+            return true;
+        }
+        auto const &tasks = pool._deques[this_worker.id].tasks;
+        return std::all_of(tasks.begin(), tasks.end(), [](auto const &lane) { return lane.empty(); });
+    }
+
+    // Keep running tasks on the calling worker until `done()` returns true, so that a worker waiting on its
+    // children never blocks the pool. Only valid if `is_worker(pool)`.
+    template <std::predicate Pred> static void help_until(Thiefpool &pool, Pred &&done) {
+        pool.help_until(std::forward<Pred>(done));
+    }
+};
+
+}  // namespace detail
 
 }  // namespace riften
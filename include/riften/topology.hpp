@@ -0,0 +1,183 @@
+// Written in 2021 by Conor Williams (cw648@cam.ac.uk)
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#if defined(__linux__)
+#    include <sched.h>
+#endif
+
+namespace riften {
+
+// Where a logical CPU sits in the machine. CPUs with the same `core` are SMT siblings, `cache` identifies
+// the last level (L3) cache and `node` the NUMA node.
+struct Cpu {
+    std::size_t id = 0;
+    std::size_t core = 0;
+    std::size_t cache = 0;
+    std::size_t node = 0;
+};
+
+namespace detail {
+
+inline std::optional<std::string> read_file(std::string const &path) {
+    std::ifstream file(path);
+    if (!file) {
+        return std::nullopt;
+    }
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+// Parse a Linux cpu-list such as "0-3,8,10-11".
+inline std::vector<std::size_t> parse_cpulist(std::string const &list) {
+    std::vector<std::size_t> cpus;
+    std::istringstream in(list);
+
+    for (std::string range; std::getline(in, range, ',');) {
+        std::size_t first = 0;
+        std::size_t last = 0;
+        char dash = 0;
+
+        std::istringstream parts(range);
+
+        if (!(parts >> first)) {
+            continue;
+        }
+        if (!(parts >> dash >> last) || dash != '-') {
+            last = first;
+        }
+        for (std::size_t cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+// The lowest CPU in the cpu-list at `path`, or `fallback` if it cannot be read.
+inline std::size_t first_in_cpulist(std::string const &path, std::size_t fallback) {
+    if (std::optional list = read_file(path)) {
+        if (std::vector cpus = parse_cpulist(*list); !cpus.empty()) {
+            return *std::min_element(cpus.begin(), cpus.end());
+        }
+    }
+    return fallback;
+}
+
+// How far apart two CPUs are: 0 for SMT siblings, 1 for a shared L3, 2 for the same node, 3 otherwise.
+inline std::size_t distance(Cpu const &a, Cpu const &b) noexcept {
+    if (a.core == b.core) {
+        return 0;
+    }
+    if (a.cache == b.cache) {
+        return 1;
+    }
+    return a.node == b.node ? 2 : 3;
+}
+
+// Restrict the calling thread to `cpu`, returns false if not supported or it failed.
+inline bool pin_this_thread(std::size_t cpu) noexcept {
+#if defined(__linux__)
+    if (cpu >= CPU_SETSIZE) {
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+}  // namespace detail
+
+// The logical CPUs this process may run on, in the order threads should be placed on them: node by node,
+// within a node cache by cache and spread over physical cores before filling their SMT siblings. Read from
+// `/sys` on Linux, elsewhere (or if `/sys` is unavailable) a flat machine of `hardware_concurrency()` CPUs.
+inline std::vector<Cpu> topology() {
+    std::vector<Cpu> cpus;
+
+#if defined(__linux__)
+    std::string const root = "/sys/devices/system/cpu/cpu";
+
+    cpu_set_t allowed;
+    bool masked = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+    std::map<std::size_t, std::size_t> node_of;
+
+    for (std::size_t node = 0;; ++node) {
+        std::string path = "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist";
+        std::optional list = detail::read_file(path);
+        if (!list) {
+            break;
+        }
+        for (std::size_t cpu : detail::parse_cpulist(*list)) {
+            node_of[cpu] = node;
+        }
+    }
+
+    if (std::optional online = detail::read_file("/sys/devices/system/cpu/online")) {
+        for (std::size_t id : detail::parse_cpulist(*online)) {
+            if (masked && (id >= CPU_SETSIZE || !CPU_ISSET(id, &allowed))) {
+                continue;
+            }
+
+            std::string dir = root + std::to_string(id);
+
+            Cpu cpu{id, detail::first_in_cpulist(dir + "/topology/thread_siblings_list", id), id, 0};
+
+            cpu.node = node_of[id];
+
+            for (std::size_t index = 0; index < 8; ++index) {
+                std::string cache = dir + "/cache/index" + std::to_string(index);
+                if (std::optional level = detail::read_file(cache + "/level"); level && *level == "3\n") {
+                    cpu.cache = detail::first_in_cpulist(cache + "/shared_cpu_list", id);
+                }
+            }
+
+            cpus.push_back(cpu);
+        }
+    }
+
+    // The n'th SMT sibling of each core sorts with rank n, every core gets a thread before any doubles up.
+    std::map<std::size_t, std::size_t> seen;
+    std::vector<std::tuple<std::size_t, std::size_t, std::size_t, std::size_t, Cpu>> keyed;
+
+    for (Cpu const &cpu : cpus) {
+        keyed.emplace_back(cpu.node, cpu.cache, seen[cpu.core]++, cpu.core, cpu);
+    }
+
+    std::sort(keyed.begin(), keyed.end(), [](auto const &a, auto const &b) {
+        return std::tie(std::get<0>(a), std::get<1>(a), std::get<2>(a), std::get<3>(a))
+               < std::tie(std::get<0>(b), std::get<1>(b), std::get<2>(b), std::get<3>(b));
+    });
+
+    cpus.clear();
+
+    for (auto const &key : keyed) {
+        cpus.push_back(std::get<4>(key));
+    }
+#endif
+
+    if (cpus.empty()) {
+        for (std::size_t id = 0; id < std::max(1u, std::thread::hardware_concurrency()); ++id) {
+            cpus.push_back({id, id, 0, 0});
+        }
+    }
+
+    return cpus;
+}
+
+}  // namespace riften
@@ -0,0 +1,181 @@
+// Written in 2021 by Conor Williams (cw648@cam.ac.uk)
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "queue.hpp"
+
+// Events kept per worker when `RIFTEN_THIEFPOOL_TRACE` is defined, the oldest are overwritten. Must be a
+// power of two.
+#if !defined(RIFTEN_THIEFPOOL_TRACE_CAPACITY)
+#    define RIFTEN_THIEFPOOL_TRACE_CAPACITY 4096
+#endif
+
+namespace riften {
+
+// Something that happened on a thread of a pool, `arg` depends on the `kind`.
+struct TraceEvent {
+    enum Kind : std::uint8_t {
+        enqueue,  // Tasks pushed, arg is how many.
+        steal,    // A successful steal, arg is the victim.
+        begin,    // A task started.
+        end,      // A task finished.
+        park,     // The worker went to sleep.
+        unpark,   // The worker woke up.
+    };
+
+    Kind kind = enqueue;
+    std::uint64_t arg = 0;
+    std::uint64_t ns = 0;  // Time on `std::chrono::steady_clock`.
+};
+
+namespace detail {
+
+// A fixed-size ring of trace events written by one thread and read, together with the events of every
+// other thread, by whoever flushes the trace. Slots are relaxed atomics so a reader racing the writer
+// never tears an event, it drops the ones that may have been overwritten while it was copying instead.
+// Empty, and every `record` compiled out, unless `RIFTEN_THIEFPOOL_TRACE` is defined.
+class TraceRing {
+  public:
+#if defined(RIFTEN_THIEFPOOL_TRACE)
+    static_assert(std::has_single_bit(std::size_t{RIFTEN_THIEFPOOL_TRACE_CAPACITY}), "Must be a power of 2");
+
+    // Only ever called by the owning thread.
+    void record(TraceEvent::Kind kind, std::uint64_t arg = 0) noexcept {
+        std::uint64_t head = _head.load(std::memory_order_relaxed);
+
+        Slot &slot = _slots[head & mask];
+
+        // Orders the previous head store before we overwrite the slot, see `events`.
+        std::atomic_thread_fence(std::memory_order_release);
+
+        auto since = std::chrono::steady_clock::now().time_since_epoch();
+
+        slot.ns.store(static_cast<std::uint64_t>(std::chrono::nanoseconds(since).count()), relaxed);
+        slot.packed.store(arg << 8 | kind, relaxed);
+
+        _head.store(head + 1, std::memory_order_release);
+    }
+
+    // As `record` but may be called by any thread, writers are serialised by a spin lock.
+    void record_shared(TraceEvent::Kind kind, std::uint64_t arg = 0) noexcept {
+        while (_writing.test_and_set(std::memory_order_acquire)) {
+            cpu_relax();
+        }
+        record(kind, arg);
+        _writing.clear(std::memory_order_release);
+    }
+
+    // Copy out the events currently in the ring, oldest first.
+    std::vector<TraceEvent> events() const {
+        std::uint64_t last = _head.load(std::memory_order_acquire);
+        std::uint64_t first = last > capacity ? last - capacity : 0;
+
+        std::vector<TraceEvent> out;
+
+        for (std::uint64_t i = first; i < last; ++i) {
+            Slot const &slot = _slots[i & mask];
+            std::uint64_t packed = slot.packed.load(relaxed);
+            out.push_back({static_cast<TraceEvent::Kind>(packed & 0xFF), packed >> 8, slot.ns.load(relaxed)});
+        }
+
+        // Anything the writer lapped while we were reading, including the slot it may be writing right now,
+        // may be a mix of two events.
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        std::uint64_t now = _head.load(relaxed) + 1;
+
+        if (std::uint64_t lapped = now > capacity ? now - capacity : 0; lapped > first) {
+            out.erase(out.begin(), out.begin() + static_cast<std::ptrdiff_t>(std::min(lapped, last) - first));
+        }
+
+        return out;
+    }
+
+  private:
+    static constexpr std::uint64_t capacity = RIFTEN_THIEFPOOL_TRACE_CAPACITY;
+    static constexpr std::uint64_t mask = capacity - 1;
+
+    struct Slot {
+        std::atomic<std::uint64_t> ns = 0;
+        std::atomic<std::uint64_t> packed = 0;
+    };
+
+    alignas(cache_line) std::atomic<std::uint64_t> _head = 0;
+    std::atomic_flag _writing = ATOMIC_FLAG_INIT;
+    std::array<Slot, capacity> _slots;
+
+    static constexpr std::memory_order relaxed = std::memory_order_relaxed;
+#else
+    void record(TraceEvent::Kind, std::uint64_t = 0) noexcept {}
+    void record_shared(TraceEvent::Kind, std::uint64_t = 0) noexcept {}
+    std::vector<TraceEvent> events() const { return {}; }
+#endif
+};
+
+// Write the events of each thread in the Chrome `trace_event` JSON format, which Perfetto also reads.
+// Tasks and parks become slices, enqueues and steals instant events. `names[i]` names the i'th thread.
+inline void write_chrome_trace(std::ostream &out,
+                               std::vector<std::vector<TraceEvent>> const &threads,
+                               std::vector<std::string> const &names) {
+    out << "{\"traceEvents\":[";
+
+    char const *sep = "\n";
+
+    auto emit = [&](std::size_t tid, char const *name, char const *phase, std::uint64_t ns) {
+        out << sep << "{\"name\":\"" << name << "\",\"ph\":\"" << phase << "\",\"pid\":0,\"tid\":" << tid
+            << ",\"ts\":" << ns / 1000 << '.' << ns / 100 % 10 << ns / 10 % 10 << ns % 10;
+        sep = ",\n";
+    };
+
+    for (std::size_t tid = 0; tid < threads.size(); ++tid) {
+        out << sep << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << tid
+            << ",\"args\":{\"name\":\"" << (tid < names.size() ? names[tid] : std::to_string(tid)) << "\"}}";
+        sep = ",\n";
+
+        for (TraceEvent const &e : threads[tid]) {
+            switch (e.kind) {
+                case TraceEvent::enqueue:
+                    emit(tid, "enqueue", "i", e.ns);
+                    out << ",\"s\":\"t\",\"args\":{\"tasks\":" << e.arg << "}}";
+                    break;
+                case TraceEvent::steal:
+                    emit(tid, "steal", "i", e.ns);
+                    out << ",\"s\":\"t\",\"args\":{\"victim\":" << e.arg << "}}";
+                    break;
+                case TraceEvent::begin:
+                    emit(tid, "task", "B", e.ns);
+                    out << '}';
+                    break;
+                case TraceEvent::end:
+                    emit(tid, "task", "E", e.ns);
+                    out << '}';
+                    break;
+                case TraceEvent::park:
+                    emit(tid, "parked", "B", e.ns);
+                    out << '}';
+                    break;
+                case TraceEvent::unpark:
+                    emit(tid, "parked", "E", e.ns);
+                    out << '}';
+                    break;
+            }
+        }
+    }
+
+    out << "\n]}\n";
+}
+
+}  // namespace detail
+
+}  // namespace riften
@@ -6,6 +6,8 @@
 
 // See <http://creativecommons.org/publicdomain/zero/1.0/>.
 
+#pragma once
+
 #include <stdint.h>
 
 namespace riften {
@@ -24,27 +26,48 @@ namespace riften {
 
 inline uint64_t rotl(const uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
 
-static thread_local uint64_t s[2] = {42, 42};  // The answer to the greatest question
+// This is splitmix64, advances `x` and returns the next output. Used to
+// expand a 64-bit seed into a full generator state.
+inline uint64_t splitmix64(uint64_t &x) {
+    uint64_t z = (x += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
 
-inline uint64_t xoroshiro128() {
-    const uint64_t s0 = s[0];
-    uint64_t s1 = s[1];
-    const uint64_t result = rotl(s0 * 5, 7) * 9;
+// The generator's state is owned by each instance, give every thread its
+// own rather than sharing one.
+class Xoroshiro128StarStar {
+  public:
+    // Any seed is fine, including zero and consecutive integers.
+    explicit Xoroshiro128StarStar(uint64_t seed) noexcept {
+        s[0] = splitmix64(seed);
+        s[1] = splitmix64(seed);
+    }
 
-    s1 ^= s0;
-    s[0] = rotl(s0, 24) ^ s1 ^ (s1 << 16);  // a, b
-    s[1] = rotl(s1, 37);                    // c
+    uint64_t operator()() noexcept {
+        const uint64_t s0 = s[0];
+        uint64_t s1 = s[1];
+        const uint64_t result = rotl(s0 * 5, 7) * 9;
 
-    return result;
-}
+        s1 ^= s0;
+        s[0] = rotl(s0, 24) ^ s1 ^ (s1 << 16);  // a, b
+        s[1] = rotl(s1, 37);                    // c
 
-// This is the jump function for the generator. It is equivalent
-// to 2^64 calls to next(); it can be used to generate 2^64
-// non-overlapping sub-sequences for parallel computations.
-inline void jump(uint64_t jumps) {
-    static constexpr uint64_t JUMP[] = {0xdf900294d8f554a5, 0x170865df4b3201fc};
+        return result;
+    }
+
+    // A number in [0, n) for any n < 2^32, by Lemire's multiply-shift
+    // rather than a division. The bias, at most n / 2^32, is irrelevant for
+    // picking victims.
+    uint32_t bounded(uint32_t n) noexcept { return static_cast<uint32_t>(((*this)() >> 32) * n >> 32); }
+
+    // This is the jump function for the generator. It is equivalent
+    // to 2^64 calls to next(); it can be used to generate 2^64
+    // non-overlapping sub-sequences for parallel computations.
+    void jump() noexcept {
+        static constexpr uint64_t JUMP[] = {0xdf900294d8f554a5, 0x170865df4b3201fc};
 
-    while (jumps--) {
         uint64_t s0 = 0;
         uint64_t s1 = 0;
 
@@ -54,12 +77,15 @@ inline void jump(uint64_t jumps) {
                     s0 ^= s[0];
                     s1 ^= s[1];
                 }
-                xoroshiro128();
+                (*this)();
             }
 
         s[0] = s0;
         s[1] = s1;
     }
-}
+
+  private:
+    uint64_t s[2];
+};
 
 }  // namespace riften
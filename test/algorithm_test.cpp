@@ -0,0 +1,179 @@
+#include "riften/algorithm.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "doctest/doctest.h"
+#include "riften/thiefpool.hpp"
+
+void for_jobs(std::size_t threads) {
+    riften::Thiefpool pool(threads);
+
+    std::vector<std::atomic<int>> hits(1'000'000);
+
+    riften::parallel_for(pool, 0, (int)hits.size(), [&](int i) { hits[i].fetch_add(1); });
+
+    for (auto &&h : hits) {
+        REQUIRE(h == 1);
+    }
+
+    riften::parallel_for(pool, hits.begin(), hits.end(), [](std::atomic<int> &h) { h.fetch_add(1); }, 7);
+
+    for (auto &&h : hits) {
+        REQUIRE(h == 2);
+    }
+}
+
+TEST_CASE("Parallel for - 1 thread" * doctest::timeout(25)) { for_jobs(1); }
+TEST_CASE("Parallel for - 2 thread" * doctest::timeout(25)) { for_jobs(2); }
+TEST_CASE("Parallel for - 4 thread" * doctest::timeout(25)) { for_jobs(4); }
+TEST_CASE("Parallel for - 12 thread" * doctest::timeout(25)) { for_jobs(12); }
+
+void reduce_jobs(std::size_t threads) {
+    riften::Thiefpool pool(threads);
+
+    std::vector<long> data(1'000'000);
+    std::iota(data.begin(), data.end(), 0);
+
+    REQUIRE(riften::parallel_reduce(pool, data.begin(), data.end(), 0l) == 999'999l * 1'000'000l / 2);
+
+    // Non-commutative, order must be preserved.
+    std::vector<std::string> words(5000);
+    std::string expect;
+
+    for (std::size_t i = 0; i < words.size(); i++) {
+        words[i] = std::to_string(i) + ',';
+        expect += words[i];
+    }
+
+    auto joined = riften::parallel_reduce(pool, words.begin(), words.end(), std::string{}, std::plus<>{}, 3);
+
+    REQUIRE(joined == expect);
+
+    std::vector<long> out(data.size());
+
+    riften::parallel_transform(pool, data.begin(), data.end(), out.begin(), [](long x) { return 2 * x; });
+
+    for (std::size_t i = 0; i < out.size(); i++) {
+        REQUIRE(out[i] == 2 * data[i]);
+    }
+}
+
+TEST_CASE("Parallel reduce/transform - 1 thread" * doctest::timeout(25)) { reduce_jobs(1); }
+TEST_CASE("Parallel reduce/transform - 2 thread" * doctest::timeout(25)) { reduce_jobs(2); }
+TEST_CASE("Parallel reduce/transform - 4 thread" * doctest::timeout(25)) { reduce_jobs(4); }
+TEST_CASE("Parallel reduce/transform - 12 thread" * doctest::timeout(25)) { reduce_jobs(12); }
+
+TEST_CASE("Parallel for - nested" * doctest::timeout(25)) {
+    riften::Thiefpool pool(1);
+
+    std::atomic<int> count = 0;
+
+    riften::parallel_for(pool, 0, 100, [&](int) {
+        riften::parallel_for(pool, 0, 100, [&](int) { count.fetch_add(1); });
+    });
+
+    REQUIRE(count == 100 * 100);
+}
+
+TEST_CASE("Parallel for - exception" * doctest::timeout(25)) {
+    riften::Thiefpool pool(4);
+
+    auto throws = [&] {
+        riften::parallel_for(pool, 0, 1'000'000, [](int i) {
+            if (i == 500'000) {
+                throw std::runtime_error("boom");
+            }
+        });
+    };
+
+    REQUIRE_THROWS_AS(throws(), std::runtime_error);
+}
+
+TEST_CASE("Parallel for - drop_oldest pool" * doctest::timeout(25)) {
+    riften::Thiefpool pool(2, {}, riften::Placement::floating, {2, riften::Overflow::drop_oldest});
+
+    for (int round = 0; round < 20; ++round) {
+        std::vector<std::atomic<int>> hits(100'000);
+
+        // Chunks may be dropped, which must fail the loop rather than leave it waiting.
+        try {
+            riften::parallel_for(pool, 0, (int)hits.size(), [&](int i) { hits[i].fetch_add(1); }, 16);
+            REQUIRE(std::all_of(hits.begin(), hits.end(), [](auto &h) { return h == 1; }));
+        } catch (std::future_error const &) {
+            REQUIRE(std::all_of(hits.begin(), hits.end(), [](auto &h) { return h <= 1; }));
+        }
+    }
+}
+
+TEST_CASE("Parallel for - run inline from outside the pool" * doctest::timeout(25)) {
+    riften::Thiefpool pool(1, {}, riften::Placement::floating, {1, riften::Overflow::run_inline});
+
+    std::atomic<bool> started = false;
+    std::atomic<bool> go = false;
+
+    pool.enqueue_detach([&] {
+        started = true;
+        while (!go) {
+            std::this_thread::yield();
+        }
+    });
+
+    while (!started) {
+        std::this_thread::yield();
+    }
+
+    pool.enqueue_detach([] {});  // Fills the injector, from now on submissions run on the caller.
+
+    auto loop = [&] {
+        std::vector<std::atomic<int>> hits(10'000);
+        riften::parallel_for(pool, 0, (int)hits.size(), [&](int i) { hits[i].fetch_add(1); }, 16);
+        return std::all_of(hits.begin(), hits.end(), [](auto &h) { return h == 1; });
+    };
+
+    // Both a thread of no pool and a worker of another pool run every chunk themselves.
+    REQUIRE(loop());
+
+    riften::Thiefpool other(8);
+
+    REQUIRE(other.enqueue(loop).get());
+
+    go = true;
+}
+
+TEST_CASE("Parallel for - run by wait_idle" * doctest::timeout(25)) {
+    riften::Thiefpool pool(1);
+
+    std::atomic<bool> started = false;
+    std::atomic<bool> go = false;
+
+    pool.enqueue_detach([&] {
+        started = true;
+        while (!go) {
+            std::this_thread::yield();
+        }
+    });
+
+    while (!started) {
+        std::this_thread::yield();
+    }
+
+    std::vector<std::atomic<int>> hits(10'000);
+
+    // The only worker is busy so every chunk is run by the thread in `wait_idle`.
+    std::thread loop([&] {
+        riften::parallel_for(pool, 0, (int)hits.size(), [&](int i) { hits[i].fetch_add(1); }, 16);
+        go = true;
+    });
+
+    pool.wait_idle();
+    loop.join();
+
+    REQUIRE(std::all_of(hits.begin(), hits.end(), [](auto &h) { return h == 1; }));
+}
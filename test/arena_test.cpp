@@ -0,0 +1,122 @@
+#include "riften/arena.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "doctest/doctest.h"
+#include "riften/thiefpool.hpp"
+
+TEST_CASE("Arena - construct-destruct on the shared pool") {
+    for (std::size_t i = 0; i < 10000; i++) {
+        riften::Arena arena;
+        REQUIRE(&arena.pool() == &riften::Thiefpool::shared());
+    }
+
+    std::atomic<int> count = 0;
+
+    for (std::size_t i = 0; i < 1000; i++) {
+        riften::Arena arena;
+        arena.enqueue_detach([&count] { ++count; });
+    }
+
+    REQUIRE(count == 1000);
+}
+
+TEST_CASE("Arena - waits for its own tasks only" * doctest::timeout(25)) {
+    riften::Thiefpool pool(3);
+
+    std::atomic<bool> release = false;
+
+    riften::Arena slow(pool);
+
+    slow.enqueue_detach([&release] {
+        while (!release.load(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+    });
+
+    std::atomic<int> count = 0;
+    {
+        riften::Arena fast(pool);
+
+        std::vector<riften::Future<int>> futures;
+
+        for (int i = 0; i < 1000; ++i) {
+            futures.push_back(fast.enqueue([&count](int x) { return ++count, x; }, i));
+        }
+
+        fast.wait();
+        REQUIRE(count == 1000);
+
+        for (int i = 0; i < 1000; ++i) {
+            REQUIRE(futures[i].get() == i);
+        }
+
+        // Nested arenas on a worker help rather than block.
+        fast.enqueue_detach([&] {
+            riften::Arena inner(pool);
+            for (int i = 0; i < 100; ++i) {
+                inner.enqueue_detach([&count] { ++count; });
+            }
+        });
+    }
+
+    REQUIRE(count == 1100);
+
+    release.store(true, std::memory_order_release);
+}
+
+TEST_CASE("Resize" * doctest::timeout(25)) {
+    riften::Thiefpool pool(4);
+
+    REQUIRE(pool.size() == 4);
+    REQUIRE(pool.capacity() == 4);
+
+    pool.resize(1);
+
+    REQUIRE(pool.size() == 1);
+
+    // Let the retired workers finish whatever they were doing.
+    pool.enqueue([] {}).get();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    std::mutex mutex;
+    std::set<std::thread::id> ids;
+
+    {
+        riften::Arena arena(pool);
+
+        for (int i = 0; i < 1000; ++i) {
+            arena.enqueue_detach([&] {
+                std::this_thread::sleep_for(std::chrono::microseconds(10));
+                std::scoped_lock lock(mutex);
+                ids.insert(std::this_thread::get_id());
+            });
+        }
+    }
+
+    REQUIRE(ids.size() == 1);
+
+    pool.resize(100);
+
+    REQUIRE(pool.size() == 4);
+
+    std::atomic<int> count = 0;
+    {
+        riften::Arena arena(pool);
+        for (int i = 0; i < 1000; ++i) {
+            arena.enqueue_detach([&count] { ++count; });
+        }
+    }
+
+    REQUIRE(count == 1000);
+
+    pool.resize(0);
+
+    REQUIRE(pool.size() == 1);
+    REQUIRE(pool.enqueue([] { return 7; }).get() == 7);
+}
@@ -0,0 +1,148 @@
+#include "riften/future.hpp"
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include "doctest/doctest.h"
+#include "riften/thiefpool.hpp"
+
+TEST_CASE("Future - values") {
+    riften::Thiefpool pool(2);
+
+    auto str = pool.enqueue([](std::string s) { return s + "!"; }, std::string("hello"));
+    auto ptr = pool.enqueue([]() { return std::make_unique<int>(42); });
+    auto none = pool.enqueue([]() {});
+
+    int x = 0;
+    auto ref = pool.enqueue([](int &y) -> int & { return y; }, std::ref(x));
+
+    REQUIRE(str.valid());
+    REQUIRE(str.get() == "hello!");
+    REQUIRE(!str.valid());
+
+    REQUIRE(*ptr.get() == 42);
+
+    none.wait();
+    REQUIRE(none.is_ready());
+    none.get();
+
+    REQUIRE(&ref.get() == &x);
+}
+
+TEST_CASE("Future - exceptions") {
+    riften::Thiefpool pool(2);
+
+    auto fut = pool.enqueue([]() -> int { throw std::runtime_error("boom"); });
+
+    REQUIRE_THROWS_AS(fut.get(), std::runtime_error);
+}
+
+TEST_CASE("Future - broken promise") {
+    riften::Future<int> fut;
+
+    {
+        riften::detail::NullaryOneShot task([]() { return 1; });
+        fut = task.get_future();
+    }
+
+    REQUIRE(fut.is_ready());
+    REQUIRE_THROWS_AS(fut.get(), std::future_error);
+}
+
+TEST_CASE("Future - function destroyed before result") {
+    riften::Thiefpool pool(1);
+
+    auto tracker = std::make_shared<int>();
+
+    auto fut = pool.enqueue([t = tracker]() { return 1; });
+
+    fut.wait();
+
+    REQUIRE(tracker.use_count() == 1);
+    REQUIRE(fut.get() == 1);
+}
+
+TEST_CASE("Future - then") {
+    riften::Thiefpool pool(1);
+
+    // A pipeline that would deadlock a single thread if any stage blocked on the previous one.
+    auto fut = pool.enqueue([]() { return 1; })
+                   .then([](int x) { return x + 1; })
+                   .then([](int x) { return std::to_string(x); })
+                   .then([](std::string s) { REQUIRE(s == "2"); })
+                   .then([]() { return 3; });
+
+    REQUIRE(fut.get() == 3);
+
+    auto err = pool.enqueue([]() -> int { throw std::runtime_error("boom"); }).then([](int x) { return x; });
+
+    REQUIRE_THROWS_AS(err.get(), std::runtime_error);
+
+    // Attached after the result is ready.
+    auto early = pool.enqueue([]() { return 5; });
+    early.wait();
+
+    REQUIRE(std::move(early).then([](int x) { return x * 2; }).get() == 10);
+}
+
+TEST_CASE("Future - when_all") {
+    riften::Thiefpool pool(4);
+
+    auto one = pool.enqueue([]() { return 1; });
+    auto str = pool.enqueue([]() { return std::string("a"); });
+
+    auto all = riften::when_all(std::move(one), std::move(str));
+
+    auto [a, b] = all.get();
+
+    REQUIRE(a.get() == 1);
+    REQUIRE(b.get() == "a");
+
+    std::vector<riften::Future<int>> futures;
+
+    for (int i = 0; i < 100; i++) {
+        futures.push_back(pool.enqueue([](int x) { return x; }, i));
+    }
+
+    auto all_ints = riften::when_all(futures.begin(), futures.end());
+
+    auto sum = std::move(all_ints).then([](std::vector<riften::Future<int>> ready) {
+        int total = 0;
+        for (auto &&f : ready) {
+            total += f.get();
+        }
+        return total;
+    });
+
+    REQUIRE(sum.get() == 99 * 100 / 2);
+
+    std::vector<riften::Future<int>> none;
+
+    REQUIRE(riften::when_all(none.begin(), none.end()).get().empty());
+}
+
+TEST_CASE("Future - when_any") {
+    riften::Thiefpool pool(2);
+
+    std::atomic<bool> go = false;
+
+    std::vector<riften::Future<int>> futures;
+
+    futures.push_back(pool.enqueue([&]() {
+        while (!go) {
+            std::this_thread::yield();
+        }
+        return 0;
+    }));
+    futures.push_back(pool.enqueue([]() { return 1; }));
+
+    auto any = riften::when_any(futures.begin(), futures.end()).get();
+
+    REQUIRE(any.index == 1);
+    REQUIRE(any.futures[1].get() == 1);
+
+    go = true;
+
+    REQUIRE(any.futures[0].get() == 0);
+}
@@ -0,0 +1,100 @@
+#include "riften/queue.hpp"
+
+#include <atomic>
+#include <memory>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+#include "doctest/doctest.h"
+
+TEST_CASE("Queue - single threaded") {
+    riften::Queue<int> queue;
+
+    REQUIRE(queue.empty());
+    REQUIRE(!queue.pop());
+
+    for (int i = 0; i < 1000; i++) {
+        queue.emplace(i);
+    }
+
+    REQUIRE(queue.size() == 1000);
+
+    for (int i = 0; i < 1000; i++) {
+        REQUIRE(queue.pop() == i);
+    }
+
+    REQUIRE(queue.empty());
+}
+
+TEST_CASE("Queue - bulk") {
+    riften::Queue<int> queue;
+
+    std::vector<int> in(1000);
+    std::iota(in.begin(), in.end(), 0);
+    queue.push_bulk(in.data(), in.size());
+
+    REQUIRE(queue.size() == 1000);
+
+    std::vector<int> out;
+
+    while (queue.pop_bulk(17, [&](int &&x) noexcept { out.push_back(x); }) > 0) {
+    }
+
+    REQUIRE(out == in);
+}
+
+TEST_CASE("Queue - destroys remaining") {
+    auto counted = std::make_shared<int>();
+
+    {
+        riften::Queue<std::shared_ptr<int>> queue;
+
+        for (int i = 0; i < 100; i++) {
+            queue.emplace(counted);
+        }
+        for (int i = 0; i < 50; i++) {
+            REQUIRE(queue.pop());
+        }
+
+        REQUIRE(counted.use_count() == 51);
+    }
+
+    REQUIRE(counted.use_count() == 1);
+}
+
+TEST_CASE("Queue - multi producer multi consumer" * doctest::timeout(25)) {
+    constexpr std::size_t threads = 4;
+    constexpr std::size_t per_thread = 1ul << 18;
+
+    riften::Queue<std::size_t> queue;
+
+    std::vector<std::atomic<int>> seen(threads * per_thread);
+    std::atomic<std::size_t> popped = 0;
+
+    {
+        std::vector<std::jthread> workers;
+
+        for (std::size_t t = 0; t < threads; t++) {
+            workers.emplace_back([&, t] {
+                for (std::size_t i = 0; i < per_thread; i++) {
+                    queue.emplace(t * per_thread + i);
+                }
+            });
+
+            workers.emplace_back([&, t] {
+                auto sink = [&](std::size_t &&x) noexcept { seen[x].fetch_add(1); };
+
+                while (popped.load() < threads * per_thread) {
+                    popped.fetch_add(t % 2 ? queue.pop_bulk(t * 8, sink) : queue.pop_bulk(1, sink));
+                }
+            });
+        }
+    }
+
+    REQUIRE(queue.empty());
+
+    for (auto &&s : seen) {
+        REQUIRE(s == 1);
+    }
+}
@@ -0,0 +1,175 @@
+#include "riften/reactor.hpp"
+
+#if defined(__linux__)
+
+#    include <sys/epoll.h>
+#    include <unistd.h>
+
+#    include <atomic>
+#    include <chrono>
+#    include <cstddef>
+#    include <future>
+#    include <system_error>
+#    include <thread>
+#    include <vector>
+
+#    include "doctest/doctest.h"
+#    include "riften/thiefpool.hpp"
+
+namespace {
+
+// Both ends of a pipe, closed on scope exit.
+struct Pipe {
+    Pipe() { REQUIRE(::pipe(fds) == 0); }
+
+    ~Pipe() {
+        ::close(fds[0]);
+        ::close(fds[1]);
+    }
+
+    int read_end() const noexcept { return fds[0]; }
+    int write_end() const noexcept { return fds[1]; }
+
+    int fds[2];
+};
+
+}  // namespace
+
+TEST_CASE("Reactor - ready descriptors run their task" * doctest::timeout(25)) {
+    riften::Thiefpool pool(2);
+    Pipe pipe;
+
+    auto fut = pool.enqueue_ready(pipe.read_end(), EPOLLIN, [&] {
+        char c = 0;
+        REQUIRE(::read(pipe.read_end(), &c, 1) == 1);
+        return c;
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    REQUIRE(!fut.is_ready());
+
+    char c = 'x';
+    REQUIRE(::write(pipe.write_end(), &c, 1) == 1);
+
+    REQUIRE(fut.get() == 'x');
+}
+
+TEST_CASE("Reactor - the poller still runs tasks" * doctest::timeout(25)) {
+    riften::Thiefpool pool(1);
+    Pipe pipe;
+
+    auto io = pool.enqueue_ready(pipe.read_end(), EPOLLIN, [] {});
+
+    // The only worker is sleeping in the reactor, submissions must still reach it.
+    for (int i = 0; i < 100; ++i) {
+        REQUIRE(pool.enqueue([i] { return i; }).get() == i);
+        std::this_thread::yield();
+    }
+
+    REQUIRE(!io.is_ready());
+
+    char c = 0;
+    REQUIRE(::write(pipe.write_end(), &c, 1) == 1);
+
+    io.get();
+}
+
+TEST_CASE("Reactor - waits can be re-armed from their task" * doctest::timeout(25)) {
+    riften::Thiefpool pool(2);
+    Pipe pipe;
+
+    constexpr int rounds = 100;
+
+    std::atomic<int> seen = 0;
+    std::atomic<bool> done = false;
+
+    // Reads one byte then waits for the next.
+    auto handler = [&](auto const &self) -> void {
+        char c = 0;
+        REQUIRE(::read(pipe.read_end(), &c, 1) == 1);
+        if (seen.fetch_add(1) + 1 == rounds) {
+            done = true;
+            done.notify_one();
+        } else {
+            (void)pool.enqueue_ready(pipe.read_end(), EPOLLIN, self, self);
+        }
+    };
+
+    (void)pool.enqueue_ready(pipe.read_end(), EPOLLIN, handler, handler);
+
+    for (int i = 0; i < rounds; ++i) {
+        while (seen.load() != i) {
+            std::this_thread::yield();
+        }
+        char c = 0;
+        REQUIRE(::write(pipe.write_end(), &c, 1) == 1);
+    }
+
+    done.wait(false);
+
+    REQUIRE(seen == rounds);
+}
+
+TEST_CASE("Reactor - timers and I/O on one worker" * doctest::timeout(25)) {
+    riften::Thiefpool pool(1);
+    Pipe pipe;
+
+    auto io = pool.enqueue_ready(pipe.read_end(), EPOLLIN, [] { return 1; });
+
+    // The poller is also the timer driver, it must not sleep through the deadline.
+    auto timer = pool.enqueue_after(std::chrono::milliseconds(20), [] { return 2; });
+
+    REQUIRE(timer.get() == 2);
+    REQUIRE(!io.is_ready());
+
+    char c = 0;
+    REQUIRE(::write(pipe.write_end(), &c, 1) == 1);
+
+    REQUIRE(io.get() == 1);
+}
+
+TEST_CASE("Reactor - one wait per descriptor and cancelling" * doctest::timeout(25)) {
+    riften::Thiefpool pool(1);
+    Pipe pipe;
+
+    auto first = pool.enqueue_ready(pipe.read_end(), EPOLLIN, [] { return 1; });
+
+    auto twice = [&] { (void)pool.enqueue_ready(pipe.read_end(), EPOLLIN, [] { return 2; }); };
+
+    REQUIRE_THROWS_AS(twice(), std::system_error);
+
+    REQUIRE(pool.cancel_ready(pipe.read_end()));
+    REQUIRE(!pool.cancel_ready(pipe.read_end()));
+    REQUIRE_THROWS_AS(first.get(), std::future_error);
+
+    // The wait is gone, so the descriptor can be waited on again.
+    auto again = pool.enqueue_ready(pipe.read_end(), EPOLLIN, [] { return 3; });
+
+    char c = 0;
+    REQUIRE(::write(pipe.write_end(), &c, 1) == 1);
+
+    REQUIRE(again.get() == 3);
+}
+
+TEST_CASE("Reactor - pending waits are discarded with the pool" * doctest::timeout(25)) {
+    Pipe pipe;
+    Pipe other;
+
+    riften::Future<void> fut;
+    riften::Future<int> chained;
+
+    {
+        riften::Thiefpool pool(1);
+        fut = pool.enqueue_ready(pipe.read_end(), EPOLLIN, [] {});
+        // The broken promise propagates through continuations scheduled on the dying pool.
+        chained = pool.enqueue_ready(other.read_end(), EPOLLIN, [] { return 1; })
+                      .then([](int x) { return x + 1; })
+                      .then([](int x) { return x + 1; });
+    }
+
+    REQUIRE_THROWS_AS(fut.get(), std::future_error);
+    REQUIRE_THROWS_AS(chained.get(), std::future_error);
+}
+
+#endif
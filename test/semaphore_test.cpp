@@ -0,0 +1,58 @@
+#include "riften/semaphore.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "doctest/doctest.h"
+
+TEST_CASE("Semaphore - acquire many") {
+    riften::Semaphore sem(0);
+
+    REQUIRE(!sem.try_acquire_many());
+
+    sem.release(5);
+    sem.release();
+
+    REQUIRE(sem.try_acquire_many());
+    REQUIRE(!sem.try_acquire_many());
+}
+
+TEST_CASE("Semaphore - ping pong" * doctest::timeout(25)) {
+    riften::Semaphore ping(0);
+    riften::Semaphore pong(0);
+
+    std::atomic<int> count = 0;
+
+    std::jthread other([&] {
+        for (int i = 0; i < 10'000; ++i) {
+            ping.acquire_many(i % 2 ? 0 : 100);  // Mix the blocking and spinning paths.
+            count.fetch_add(1, std::memory_order_relaxed);
+            pong.release();
+        }
+    });
+
+    for (int i = 0; i < 10'000; ++i) {
+        ping.release();
+        pong.acquire_many(0);
+        REQUIRE(count.load(std::memory_order_relaxed) == i + 1);
+    }
+}
+
+TEST_CASE("Semaphore - timed acquire" * doctest::timeout(25)) {
+    using namespace std::chrono_literals;
+
+    riften::Semaphore sem(0);
+
+    auto start = std::chrono::steady_clock::now();
+
+    REQUIRE(!sem.try_acquire_many_until(start + 20ms));
+    REQUIRE(std::chrono::steady_clock::now() - start >= 20ms);
+
+    std::jthread other([&] {
+        std::this_thread::sleep_for(10ms);
+        sem.release();
+    });
+
+    REQUIRE(sem.try_acquire_many_until(std::chrono::steady_clock::now() + 10s));
+}
@@ -0,0 +1,121 @@
+#include "riften/slab.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "doctest/doctest.h"
+#include "riften/thiefpool.hpp"
+
+using riften::detail::Slab;
+
+TEST_CASE("Slab - blocks are aligned, distinct and reused") {
+    std::vector<void *> blocks;
+
+    for (std::size_t size : {1, 16, 48, 100, 200, 500, 1000, 5000}) {
+        for (int i = 0; i < 100; ++i) {
+            void *ptr = Slab::allocate(size);
+            REQUIRE(reinterpret_cast<std::uintptr_t>(ptr) % alignof(std::max_align_t) == 0);
+            std::memset(ptr, 0xAB, size);
+            blocks.push_back(ptr);
+        }
+    }
+
+    REQUIRE(std::set<void *>(blocks.begin(), blocks.end()).size() == blocks.size());
+
+    for (void *ptr : blocks) {
+        Slab::deallocate(ptr);
+    }
+
+    void *a = Slab::allocate(32);
+    Slab::deallocate(a);
+    void *b = Slab::allocate(32);
+    Slab::deallocate(b);
+
+    REQUIRE(a == b);
+}
+
+TEST_CASE("Slab - blocks freed by other threads and after their owner exits") {
+    std::vector<void *> blocks;
+
+    std::thread([&] {
+        for (int i = 0; i < 10'000; ++i) {
+            blocks.push_back(Slab::allocate(static_cast<std::size_t>(i % 900)));
+        }
+    }).join();
+
+    std::thread([&] {
+        for (void *ptr : blocks) {
+            Slab::deallocate(ptr);
+        }
+    }).join();
+
+    // Ping-pong blocks between an allocating and a freeing thread.
+    std::atomic<void *> slot = nullptr;
+
+    bool in_order = true;
+
+    std::thread consumer([&] {
+        for (int i = 0; i < 10'000; ++i) {
+            void *ptr = nullptr;
+            while (!(ptr = slot.exchange(nullptr, std::memory_order_acquire))) {
+                std::this_thread::yield();
+            }
+            in_order = in_order && *static_cast<int *>(ptr) == i;
+            Slab::deallocate(ptr);
+        }
+    });
+
+    for (int i = 0; i < 10'000; ++i) {
+        void *ptr = Slab::allocate(sizeof(int));
+        *static_cast<int *>(ptr) = i;
+        while (slot.load(std::memory_order_relaxed)) {
+            std::this_thread::yield();
+        }
+        slot.store(ptr, std::memory_order_release);
+    }
+
+    consumer.join();
+
+    REQUIRE(in_order);
+}
+
+TEST_CASE("Slab - large closures") {
+    riften::Thiefpool pool(4);
+
+    std::array<std::size_t, 64> small{};
+    std::array<std::size_t, 512> large{};
+
+    std::iota(small.begin(), small.end(), 0);
+    std::iota(large.begin(), large.end(), 0);
+
+    std::vector<riften::Future<std::size_t>> futures;
+
+    for (int i = 0; i < 1000; ++i) {
+        futures.push_back(pool.enqueue([small] { return std::accumulate(small.begin(), small.end(), 0ul); }));
+        futures.push_back(pool.enqueue([large] { return std::accumulate(large.begin(), large.end(), 0ul); }));
+    }
+
+    for (std::size_t i = 0; i < futures.size(); i += 2) {
+        REQUIRE(futures[i].get() == 63 * 64 / 2);
+        REQUIRE(futures[i + 1].get() == 511 * 512 / 2);
+    }
+
+    std::atomic<std::size_t> sum = 0;
+
+    for (int i = 0; i < 1000; ++i) {
+        pool.enqueue_detach([&sum, small] { sum += small.back(); });
+    }
+
+    pool.enqueue_bulk(1000, [&](std::size_t) { return [&sum, large] { sum += large.back(); }; });
+
+    while (sum != 1000 * (63 + 511)) {
+        std::this_thread::yield();
+    }
+}
@@ -0,0 +1,172 @@
+#include "riften/task_graph.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <future>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "doctest/doctest.h"
+#include "riften/thiefpool.hpp"
+
+TEST_CASE("TaskGraph - dependencies hold on every run" * doctest::timeout(25)) {
+    for (std::size_t threads : {1, 2, 4}) {
+        riften::Thiefpool pool(threads);
+        riften::TaskGraph graph;
+
+        // Layers of nodes, every node of a layer depends on every node of the previous one.
+        constexpr std::size_t layers = 8;
+        constexpr std::size_t width = 16;
+
+        std::vector<std::atomic<std::size_t>> finished(layers);
+        std::atomic<bool> ordered = true;
+
+        std::vector<riften::TaskGraph::Node> prev;
+
+        for (std::size_t l = 0; l < layers; ++l) {
+            std::vector<riften::TaskGraph::Node> layer;
+
+            for (std::size_t w = 0; w < width; ++w) {
+                layer.push_back(graph.emplace([&, l] {
+                    if (l > 0 && finished[l - 1].load() % width != 0) {
+                        ordered = false;
+                    }
+                    finished[l].fetch_add(1);
+                }));
+                for (auto p : prev) {
+                    graph.precede(p, layer.back());
+                }
+            }
+            prev = std::move(layer);
+        }
+
+        REQUIRE(graph.size() == layers * width);
+
+        for (std::size_t run = 1; run <= 10; ++run) {
+            graph.run(pool);
+            graph.wait();
+
+            for (auto const &count : finished) {
+                REQUIRE(count.load() == run * width);
+            }
+        }
+
+        REQUIRE(ordered);
+    }
+}
+
+TEST_CASE("TaskGraph - long chain and empty graph") {
+    riften::Thiefpool pool(2);
+
+    riften::TaskGraph empty;
+    empty.run(pool);
+    empty.wait();
+
+    riften::TaskGraph chain;
+
+    std::size_t last = 0;  // Only ever touched by one node at a time.
+    bool in_order = true;
+
+    for (std::size_t i = 0; i < 1000; ++i) {
+        auto node = chain.emplace([&, i] {
+            in_order = in_order && last == i;
+            last = i + 1;
+        });
+        if (i > 0) {
+            chain.precede(node - 1, node);
+        }
+    }
+
+    chain.run(pool);
+    chain.wait();
+
+    REQUIRE(in_order);
+    REQUIRE(last == 1000);
+}
+
+TEST_CASE("TaskGraph - run and wait inside a task" * doctest::timeout(25)) {
+    riften::Thiefpool pool(1);
+
+    std::atomic<int> count = 0;
+
+    riften::TaskGraph graph;
+
+    auto root = graph.emplace([&] { count.fetch_add(1); });
+
+    for (int i = 0; i < 10; ++i) {
+        graph.precede(root, graph.emplace([&] { count.fetch_add(1); }));
+    }
+
+    // With a single worker this only finishes because the waiting worker runs the graph's nodes.
+    pool.enqueue([&] {
+            graph.run(pool);
+            graph.wait();
+        })
+        .get();
+
+    REQUIRE(count == 11);
+}
+
+TEST_CASE("TaskGraph - exceptions") {
+    riften::Thiefpool pool(2);
+    riften::TaskGraph graph;
+
+    std::atomic<bool> after = false;
+
+    auto a = graph.emplace([] { throw std::runtime_error("boom"); });
+    auto b = graph.emplace([&] { after = true; });
+
+    graph.precede(a, b);
+
+    graph.run(pool);
+    REQUIRE_THROWS_AS(graph.wait(), std::runtime_error);
+    REQUIRE(!after);
+
+    // The graph can be run again.
+    graph.run(pool);
+    REQUIRE_THROWS_AS(graph.wait(), std::runtime_error);
+}
+
+TEST_CASE("TaskGraph - cancelled nodes skip their successors" * doctest::timeout(25)) {
+    riften::Thiefpool pool(1);
+
+    std::atomic<bool> started = false;
+    std::atomic<bool> go = false;
+
+    pool.enqueue_detach([&] {
+        started = true;
+        while (!go) {
+            std::this_thread::yield();
+        }
+    });
+
+    while (!started) {
+        std::this_thread::yield();
+    }
+
+    std::atomic<int> ran = 0;
+
+    riften::TaskGraph graph;
+
+    auto a = graph.emplace([&] { ran.fetch_add(1); });
+    auto b = graph.emplace([&] { ran.fetch_add(1); });
+    auto c = graph.emplace([&] { ran.fetch_add(1); });
+    auto d = graph.emplace([&] { ran.fetch_add(1); });
+
+    graph.precede(a, c);
+    graph.precede(b, c);
+    graph.precede(c, d);
+
+    graph.run(pool);
+
+    REQUIRE(pool.cancel_pending() == 2);
+    REQUIRE_THROWS_AS(graph.wait(), std::future_error);
+
+    go = true;
+
+    graph.run(pool);
+    graph.wait();
+
+    REQUIRE(ran == 4);
+}
@@ -0,0 +1,146 @@
+#include "riften/task_group.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <future>
+#include <stdexcept>
+#include <thread>
+
+#include "doctest/doctest.h"
+#include "riften/thiefpool.hpp"
+
+namespace {
+
+long fib(riften::Thiefpool &pool, int n) {
+    if (n < 2) {
+        return n;
+    }
+
+    long a = 0;
+    long b = 0;
+
+    riften::TaskGroup group(pool);
+
+    group.spawn([&] { a = fib(pool, n - 1); });
+    group.spawn([&] { b = fib(pool, n - 2); });
+    group.sync();
+
+    return a + b;
+}
+
+}  // namespace
+
+TEST_CASE("TaskGroup - recursive fork-join" * doctest::timeout(25)) {
+    for (std::size_t threads : {1, 2, 3, 4, 12}) {
+        riften::Thiefpool pool(threads);
+
+        REQUIRE(pool.enqueue(fib, std::ref(pool), 20).get() == 6765);  // Sync on workers
+        REQUIRE(fib(pool, 20) == 6765);                                  // Sync from outside
+    }
+}
+
+TEST_CASE("TaskGroup - reuse and empty sync") {
+    riften::Thiefpool pool(2);
+    riften::TaskGroup group(pool);
+
+    group.sync();
+
+    std::atomic<int> count = 0;
+
+    for (int round = 1; round <= 3; ++round) {
+        for (int i = 0; i < 100; ++i) {
+            group.spawn([&] { count.fetch_add(1, std::memory_order_relaxed); });
+        }
+        group.sync();
+        REQUIRE(count == 100 * round);
+    }
+}
+
+TEST_CASE("TaskGroup - exceptions") {
+    riften::Thiefpool pool(2);
+    riften::TaskGroup group(pool);
+
+    group.spawn([] { throw std::runtime_error("boom"); });
+    group.spawn([] {});
+
+    REQUIRE_THROWS_AS(group.sync(), std::runtime_error);
+
+    bool ran = false;
+    group.spawn([&] { ran = true; });
+    group.sync();
+
+    REQUIRE(ran);
+}
+
+TEST_CASE("TaskGroup - cancelled tasks break the promise" * doctest::timeout(25)) {
+    riften::Thiefpool pool(1);
+
+    std::atomic<bool> started = false;
+    std::atomic<bool> go = false;
+
+    pool.enqueue_detach([&] {
+        started = true;
+        while (!go) {
+            std::this_thread::yield();
+        }
+    });
+
+    while (!started) {
+        std::this_thread::yield();
+    }
+
+    std::atomic<int> ran = 0;
+
+    riften::TaskGroup group(pool);
+
+    for (int i = 0; i < 10; ++i) {
+        group.spawn([&] { ran.fetch_add(1); });
+    }
+
+    riften::Batch batch = pool.enqueue_n(10, [&](std::size_t) { ran.fetch_add(1); });
+
+    // Neither would ever finish if discarding their tasks left them waiting.
+    REQUIRE(pool.cancel_pending() == 20);
+    REQUIRE_THROWS_AS(group.sync(), std::future_error);
+    REQUIRE_THROWS_AS(batch.get(), std::future_error);
+
+    go = true;
+
+    // The group is still usable.
+    group.spawn([&] { ran.fetch_add(1); });
+    group.sync();
+
+    REQUIRE(ran == 1);
+}
+
+TEST_CASE("TaskGroup - dropped tasks break the promise" * doctest::timeout(25)) {
+    riften::Thiefpool pool(1, {}, riften::Placement::floating, {4, riften::Overflow::drop_oldest});
+
+    std::atomic<bool> started = false;
+    std::atomic<bool> go = false;
+
+    pool.enqueue_detach([&] {
+        started = true;
+        while (!go) {
+            std::this_thread::yield();
+        }
+    });
+
+    while (!started) {
+        std::this_thread::yield();
+    }
+
+    std::atomic<int> ran = 0;
+
+    riften::TaskGroup group(pool);
+
+    for (int i = 0; i < 16; ++i) {
+        group.spawn([&] { ran.fetch_add(1); });
+    }
+
+    go = true;
+
+    // The injector only holds four tasks, the other twelve were dropped which also skips those four.
+    REQUIRE_THROWS_AS(group.sync(), std::future_error);
+    REQUIRE(ran == 0);
+}
@@ -0,0 +1,120 @@
+#include "riften/task.hpp"
+
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "doctest/doctest.h"
+#include "riften/thiefpool.hpp"
+
+namespace {
+
+riften::Task<int> fib(int n) {
+    if (n < 2) {
+        co_return n;
+    }
+    int a = co_await fib(n - 1);
+    int b = co_await fib(n - 2);
+    co_return a + b;
+}
+
+riften::Task<std::thread::id> hop(riften::Thiefpool &pool) {
+    co_await pool.schedule();
+    co_return std::this_thread::get_id();
+}
+
+}  // namespace
+
+TEST_CASE("Task - schedule resumes on a worker") {
+    riften::Thiefpool pool(2);
+
+    auto id = riften::spawn(pool, hop(pool)).get();
+
+    REQUIRE(id != std::this_thread::get_id());
+}
+
+TEST_CASE("Task - lazy start") {
+    riften::Thiefpool pool(2);
+
+    bool started = false;
+
+    auto lazy = [&]() -> riften::Task<int> {
+        started = true;
+        co_return 1;
+    }();
+
+    REQUIRE(!started);
+    REQUIRE(riften::spawn(pool, std::move(lazy)).get() == 1);
+    REQUIRE(started);
+}
+
+TEST_CASE("Task - nested awaits") {
+    riften::Thiefpool pool(3);
+
+    REQUIRE(riften::spawn(pool, fib(20)).get() == 6765);
+}
+
+TEST_CASE("Task - values and exceptions") {
+    riften::Thiefpool pool(2);
+
+    int x = 0;
+
+    auto ref = [](int &y) -> riften::Task<int &> { co_return y; };
+    auto ptr = []() -> riften::Task<std::unique_ptr<int>> { co_return std::make_unique<int>(42); };
+    auto none = [](int &y) -> riften::Task<> {
+        y = 7;
+        co_return;
+    };
+    auto boom = []() -> riften::Task<int> {
+        throw std::runtime_error("boom");
+        co_return 0;
+    };
+
+    REQUIRE(&riften::spawn(pool, ref(x)).get() == &x);
+    REQUIRE(*riften::spawn(pool, ptr()).get() == 42);
+
+    riften::spawn(pool, none(x)).get();
+    REQUIRE(x == 7);
+
+    REQUIRE_THROWS_AS(riften::spawn(pool, boom()).get(), std::runtime_error);
+
+    auto catcher = [&]() -> riften::Task<bool> {
+        try {
+            co_await boom();
+        } catch (std::runtime_error const &) {
+            co_return true;
+        }
+        co_return false;
+    };
+
+    REQUIRE(riften::spawn(pool, catcher()).get());
+}
+
+TEST_CASE("Task - many coroutines" * doctest::timeout(25)) {
+    for (std::size_t threads : {1, 2, 3, 4, 12}) {
+        riften::Thiefpool pool(threads);
+
+        std::atomic<int> count = 0;
+
+        auto bounce = [&]() -> riften::Task<> {
+            for (int i = 0; i < 10; ++i) {
+                co_await pool.schedule();
+                count.fetch_add(1, std::memory_order_relaxed);
+            }
+        };
+
+        std::vector<riften::Future<void>> futures;
+
+        for (int i = 0; i < 1000; ++i) {
+            futures.push_back(riften::spawn(pool, bounce()));
+        }
+
+        for (auto &&future : futures) {
+            future.get();
+        }
+
+        REQUIRE(count == 10'000);
+    }
+}
@@ -3,8 +3,13 @@
 
 #include "riften/thiefpool.hpp"
 
+#include <algorithm>
+#include <chrono>
 #include <future>
 #include <iostream>
+#include <numeric>
+#include <stdexcept>
+#include <stop_token>
 #include <thread>
 #include <vector>
 
@@ -14,8 +19,16 @@ TEST_CASE("Construct-Destruct") {
     }
 }
 
+TEST_CASE("Construct - at least one worker" * doctest::timeout(25)) {
+    riften::Thiefpool pool(0);
+
+    REQUIRE(pool.size() == 1);
+    REQUIRE(pool.enqueue([] { return 1; }).get() == 1);
+    REQUIRE(riften::Thiefpool::shared().size() >= 1);
+}
+
 void null_jobs(std::size_t threads) {
-    std::vector<std::future<void>> future;
+    std::vector<riften::Future<void>> future;
 
     {
         riften::Thiefpool pool(threads);
@@ -58,7 +71,7 @@ TEST_CASE("Detach jobs - 4 thread" * doctest::timeout(25)) { detach_job(4); }
 TEST_CASE("Detach jobs - 12 thread" * doctest::timeout(25)) { detach_job(12); }
 
 void fast_jobs(std::size_t threads) {
-    std::vector<std::future<int>> future;
+    std::vector<riften::Future<int>> future;
 
     {
         riften::Thiefpool pool(threads);
@@ -81,7 +94,7 @@ TEST_CASE("Fast jobs - 4 thread" * doctest::timeout(25)) { fast_jobs(4); }
 TEST_CASE("Fast jobs - 12 thread" * doctest::timeout(25)) { fast_jobs(12); }
 
 void waiting_jobs(std::size_t threads) {
-    std::vector<std::future<int>> future;
+    std::vector<riften::Future<int>> future;
 
     {
         riften::Thiefpool pool(threads);
@@ -109,7 +122,7 @@ TEST_CASE("Waiting jobs - 4 thread" * doctest::timeout(25)) { waiting_jobs(4); }
 TEST_CASE("Waiting jobs - 12 thread" * doctest::timeout(25)) { waiting_jobs(12); }
 
 void heterogenous_wait(std::size_t threads) {
-    std::vector<std::future<void>> future;
+    std::vector<riften::Future<void>> future;
 
     {
         riften::Thiefpool pool(threads);
@@ -133,7 +146,7 @@ TEST_CASE("Heterogenous waiting jobs - 4 thread" * doctest::timeout(25)) { heter
 TEST_CASE("Heterogenous waiting jobs - 12 thread" * doctest::timeout(25)) { heterogenous_wait(12); }
 
 void heavy_jobs(std::size_t threads) {
-    std::vector<std::future<bool>> future;
+    std::vector<riften::Future<bool>> future;
 
     {
         riften::Thiefpool pool(threads);
@@ -162,3 +175,696 @@ TEST_CASE("Heavy jobs - 2 thread" * doctest::timeout(25)) { heavy_jobs(2); }
 TEST_CASE("Heavy jobs - 3 thread" * doctest::timeout(25)) { heavy_jobs(3); }
 TEST_CASE("Heavy jobs - 4 thread" * doctest::timeout(25)) { heavy_jobs(4); }
 TEST_CASE("Heavy jobs - 12 thread" * doctest::timeout(25)) { heavy_jobs(12); }
+
+void nested_jobs(std::size_t threads) {
+    std::atomic<std::size_t> counter = 0;
+
+    {
+        riften::Thiefpool pool(threads);
+
+        for (std::size_t i = 0; i < 1000; i++) {
+            pool.enqueue_detach([&]() {
+                for (std::size_t j = 0; j < 1000; j++) {
+                    pool.enqueue_detach([&]() { counter.fetch_add(1); });
+                }
+            });
+        }
+    }
+
+    REQUIRE(counter == 1000 * 1000);
+}
+
+TEST_CASE("Nested jobs - 1 thread" * doctest::timeout(25)) { nested_jobs(1); }
+TEST_CASE("Nested jobs - 2 thread" * doctest::timeout(25)) { nested_jobs(2); }
+TEST_CASE("Nested jobs - 3 thread" * doctest::timeout(25)) { nested_jobs(3); }
+TEST_CASE("Nested jobs - 4 thread" * doctest::timeout(25)) { nested_jobs(4); }
+TEST_CASE("Nested jobs - 12 thread" * doctest::timeout(25)) { nested_jobs(12); }
+
+void multi_producer(std::size_t threads) {
+    std::atomic<std::size_t> counter = 0;
+
+    {
+        riften::Thiefpool pool(threads);
+
+        std::vector<std::jthread> producers;
+
+        for (std::size_t i = 0; i < 4; i++) {
+            producers.emplace_back([&] {
+                for (std::size_t j = 0; j < (1ul << 18); j++) {
+                    pool.enqueue_detach([&]() { counter.fetch_add(1); });
+                }
+            });
+        }
+    }
+
+    REQUIRE(counter == 4 * (1ul << 18));
+}
+
+TEST_CASE("Multiple producers - 1 thread" * doctest::timeout(25)) { multi_producer(1); }
+TEST_CASE("Multiple producers - 2 thread" * doctest::timeout(25)) { multi_producer(2); }
+TEST_CASE("Multiple producers - 3 thread" * doctest::timeout(25)) { multi_producer(3); }
+TEST_CASE("Multiple producers - 4 thread" * doctest::timeout(25)) { multi_producer(4); }
+TEST_CASE("Multiple producers - 12 thread" * doctest::timeout(25)) { multi_producer(12); }
+
+void bulk_jobs(std::size_t threads) {
+    std::atomic<std::size_t> counter = 0;
+
+    std::vector<std::function<void()>> jobs(1000, [&]() { counter.fetch_add(1); });
+
+    {
+        riften::Thiefpool pool(threads);
+
+        pool.enqueue_bulk(1ul << 20, [&](std::size_t i) {
+            return [&counter, i]() { counter.fetch_add(i); };
+        });
+
+        pool.enqueue_bulk(jobs.begin(), jobs.end());
+
+        // From inside the pool.
+        pool.enqueue_detach([&]() { pool.enqueue_bulk(jobs.begin(), jobs.end()); });
+    }
+
+    REQUIRE(counter == (1ul << 20) * ((1ul << 20) - 1) / 2 + 2000);
+}
+
+TEST_CASE("Bulk jobs - 1 thread" * doctest::timeout(25)) { bulk_jobs(1); }
+TEST_CASE("Bulk jobs - 2 thread" * doctest::timeout(25)) { bulk_jobs(2); }
+TEST_CASE("Bulk jobs - 3 thread" * doctest::timeout(25)) { bulk_jobs(3); }
+TEST_CASE("Bulk jobs - 4 thread" * doctest::timeout(25)) { bulk_jobs(4); }
+TEST_CASE("Bulk jobs - 12 thread" * doctest::timeout(25)) { bulk_jobs(12); }
+
+int nested_wait(riften::Thiefpool &pool, int depth) {
+    if (depth == 0) {
+        return 1;
+    }
+    auto left = pool.enqueue(nested_wait, std::ref(pool), depth - 1);
+    auto right = pool.enqueue(nested_wait, std::ref(pool), depth - 1);
+    pool.wait(left);
+    pool.wait(right);
+    return left.get() + right.get();
+}
+
+void nested_waits(std::size_t threads) {
+    riften::Thiefpool pool(threads);
+
+    auto root = pool.enqueue(nested_wait, std::ref(pool), 12);
+    pool.wait(root);
+
+    REQUIRE(root.get() == 1 << 12);
+}
+
+TEST_CASE("Nested waits - 1 thread" * doctest::timeout(25)) { nested_waits(1); }
+TEST_CASE("Nested waits - 2 thread" * doctest::timeout(25)) { nested_waits(2); }
+TEST_CASE("Nested waits - 3 thread" * doctest::timeout(25)) { nested_waits(3); }
+TEST_CASE("Nested waits - 4 thread" * doctest::timeout(25)) { nested_waits(4); }
+TEST_CASE("Nested waits - 12 thread" * doctest::timeout(25)) { nested_waits(12); }
+
+void idle_policy(riften::IdlePolicy idle) {
+    riften::Thiefpool pool(4, idle);
+
+    for (int round = 0; round < 10; ++round) {
+        std::vector<riften::Future<int>> results;
+
+        for (int i = 0; i < 100; ++i) {
+            results.push_back(pool.enqueue([i] { return i; }));
+        }
+
+        for (int i = 0; i < 100; ++i) {
+            REQUIRE(results[i].get() == i);
+        }
+    }
+
+    // Workers that ran tasks park again once there is nothing left to do.
+    while (pool.idle_stats().parks == 0) {
+        std::this_thread::yield();
+    }
+
+    riften::IdleStats stats = pool.idle_stats();
+
+    REQUIRE(stats.spins >= stats.parks * idle.spin_rounds);  // Every park follows a full round of spinning.
+    REQUIRE(stats.yields >= stats.parks * idle.yield_rounds);
+}
+
+TEST_CASE("Idle policy - default" * doctest::timeout(25)) { idle_policy({}); }
+TEST_CASE("Idle policy - park eagerly" * doctest::timeout(25)) { idle_policy({0, 0, 0, 1}); }
+TEST_CASE("Idle policy - spin long" * doctest::timeout(25)) { idle_policy({10, 1000, 100, 128}); }
+
+TEST_CASE("Snapshot" * doctest::timeout(25)) {
+    riften::Thiefpool pool(4);
+
+    std::atomic<int> children = 0;
+
+    std::vector<riften::Future<void>> futures;
+
+    for (int i = 0; i < 1000; ++i) {
+        futures.push_back(pool.enqueue([&] { pool.enqueue_detach([&] { ++children; }); }));
+    }
+
+    for (auto &&future : futures) {
+        future.get();
+    }
+
+    while (children != 1000) {
+        std::this_thread::yield();
+    }
+
+    riften::PoolStats stats = pool.snapshot();
+
+    REQUIRE(stats.workers.size() == 4);
+
+#if defined(RIFTEN_THIEFPOOL_STATS)
+    // A task is counted just after it returns.
+    while ((stats = pool.snapshot()).total.executed != 2000) {
+        std::this_thread::yield();
+    }
+
+    REQUIRE(stats.total.injected == 1000);
+    REQUIRE(stats.total.local + stats.total.injected >= 1000);
+    REQUIRE(stats.total.high_water >= 1);
+
+    std::uint64_t executed = 0;
+
+    for (riften::WorkerStats const &w : stats.workers) {
+        executed += w.executed;
+        REQUIRE(w.high_water <= stats.total.high_water);
+    }
+
+    REQUIRE(executed == 2000);
+#else
+    REQUIRE(stats.total.executed == 0);
+#endif
+}
+
+TEST_CASE("Wait idle" * doctest::timeout(25)) {
+    for (std::size_t threads : {1, 2, 4}) {
+        riften::Thiefpool pool(threads);
+
+        for (int phase = 0; phase < 10; ++phase) {
+            std::atomic<int> count = 0;
+
+            for (int i = 0; i < 1000; ++i) {
+                pool.enqueue_detach([&] {
+                    count.fetch_add(1, std::memory_order_relaxed);
+                    pool.enqueue_detach([&count] { count.fetch_add(1, std::memory_order_relaxed); });
+                });
+            }
+
+            pool.wait_idle();
+
+            REQUIRE(pool.is_idle());
+            REQUIRE(count == 2000);
+        }
+    }
+}
+
+TEST_CASE("Shutdown - cancel" * doctest::timeout(25)) {
+    riften::Thiefpool pool(1);
+
+    std::atomic<bool> started = false;
+    std::atomic<bool> go = false;
+
+    auto blocker = pool.enqueue([&] {
+        started.store(true, std::memory_order_release);
+        while (!go.load(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+    });
+
+    // Make sure the worker is busy before queueing more.
+    while (!started.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+    }
+
+    std::vector<riften::Future<int>> futures;
+
+    for (int i = 0; i < 100; ++i) {
+        futures.push_back(pool.enqueue([i] { return i; }));
+    }
+
+    std::thread release([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        go.store(true, std::memory_order_release);
+    });
+
+    pool.shutdown(riften::Shutdown::cancel);
+
+    release.join();
+    blocker.get();
+
+    std::size_t broken = 0;
+
+    for (auto &&future : futures) {
+        try {
+            future.get();
+        } catch (std::future_error const &) {
+            ++broken;
+        }
+    }
+
+    REQUIRE(broken == 100);
+
+    // The pool is still usable.
+    REQUIRE(pool.enqueue([] { return 42; }).get() == 42);
+    pool.shutdown();
+    REQUIRE(pool.is_idle());
+}
+
+TEST_CASE("Cancellation" * doctest::timeout(25)) {
+    riften::Thiefpool pool(1);
+
+    std::atomic<bool> started = false;
+    std::atomic<bool> go = false;
+
+    std::stop_source request;
+
+    pool.enqueue_detach([&] {
+        started.store(true, std::memory_order_release);
+        while (!go.load(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+    });
+
+    while (!started.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+    }
+
+    std::atomic<int> ran = 0;
+
+    std::vector<riften::Future<int>> futures;
+
+    for (int i = 0; i < 100; ++i) {
+        futures.push_back(pool.enqueue(request.get_token(), [&ran](int x) { return ++ran, x; }, i));
+        pool.enqueue_detach(request.get_token(), [&ran] { ++ran; });
+    }
+
+    std::stop_source other;
+
+    auto kept = pool.enqueue(other.get_token(), [](std::stop_token token) { return token.stop_requested(); });
+
+    request.request_stop();
+    go.store(true, std::memory_order_release);
+
+    for (auto &&future : futures) {
+        REQUIRE_THROWS_AS(future.get(), riften::TaskCancelled);
+    }
+
+    REQUIRE(!kept.get());
+
+    pool.wait_idle();
+
+    REQUIRE(ran == 0);
+
+    // A token stopped after the task started is only seen by tasks which take it.
+    std::stop_source late;
+
+    std::atomic<bool> running = false;
+
+    auto polled = pool.enqueue(late.get_token(), [&running](std::stop_token token) {
+        running.store(true, std::memory_order_release);
+        while (!token.stop_requested()) {
+            std::this_thread::yield();
+        }
+        return 1;
+    });
+
+    while (!running.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+    }
+
+    late.request_stop();
+
+    REQUIRE(polled.get() == 1);
+}
+
+TEST_CASE("Local pushes wake a thief" * doctest::timeout(25)) {
+    riften::Thiefpool pool(2);
+
+    for (int i = 0; i < 100; ++i) {
+        // The parent never helps, its child can only run if the parked worker is woken to steal it.
+        pool.enqueue([&pool] {
+                std::atomic<bool> done = false;
+                pool.enqueue_detach([&done] { done.store(true, std::memory_order_release); });
+                while (!done.load(std::memory_order_acquire)) {
+                    std::this_thread::yield();
+                }
+            })
+            .get();
+    }
+}
+
+TEST_CASE("Priorities" * doctest::timeout(25)) {
+    riften::Thiefpool pool(1);
+
+    std::vector<int> order;
+
+    // Block the only worker while the queue fills up, in reverse priority order.
+    std::atomic<bool> go = false;
+
+    pool.enqueue_detach([&go] {
+        while (!go.load(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+    });
+
+    auto background = pool.enqueue(riften::Priority::background, [&order] { order.push_back(2); });
+    auto normal = pool.enqueue([&order] { order.push_back(1); });
+    pool.enqueue_detach(riften::Priority::high, [&order](int x) { order.push_back(x); }, 0);
+
+    go.store(true, std::memory_order_release);
+
+    background.get();
+    normal.get();
+
+    REQUIRE(order == std::vector<int>{0, 1, 2});
+}
+
+TEST_CASE("Timers" * doctest::timeout(25)) {
+    using namespace std::chrono_literals;
+
+    for (std::size_t threads : {1, 2, 4}) {
+        riften::Thiefpool pool(threads);
+
+        auto start = riften::Thiefpool::clock::now();
+
+        auto late = pool.enqueue_after(50ms, [] { return riften::Thiefpool::clock::now(); });
+        auto early = pool.enqueue_at(start + 10ms, [](int x) { return x; }, 7);
+
+        std::atomic<int> ticks = 0;
+
+        pool.enqueue_every(5ms, [&ticks] { return ticks.fetch_add(1, std::memory_order_relaxed) + 1 < 5; });
+
+        REQUIRE(early.get() == 7);
+        REQUIRE(late.get() - start >= 50ms);
+
+        while (ticks.load(std::memory_order_relaxed) < 5) {
+            std::this_thread::yield();
+        }
+
+        std::this_thread::sleep_for(20ms);
+
+        REQUIRE(ticks.load(std::memory_order_relaxed) == 5);
+    }
+}
+
+TEST_CASE("Timers - busy pool" * doctest::timeout(25)) {
+    using namespace std::chrono_literals;
+
+    std::atomic<bool> stop = false;
+    std::function<void()> churn;
+
+    riften::Thiefpool pool(1);
+
+    // Keep the only worker busy with an endless stream of tasks, it must still fire the timer.
+    churn = [&] {
+        if (!stop.load(std::memory_order_acquire)) {
+            pool.enqueue_detach(churn);
+        }
+    };
+
+    pool.enqueue_detach(churn);
+
+    pool.enqueue_after(10ms, [] {}).get();
+
+    stop.store(true, std::memory_order_release);
+}
+
+TEST_CASE("Timers - discarded on destruction" * doctest::timeout(25)) {
+    using namespace std::chrono_literals;
+
+    riften::Future<int> never;
+    riften::Future<int> chained;
+
+    {
+        riften::Thiefpool pool(2);
+        never = pool.enqueue_after(1h, [] { return 1; });
+        // The broken promise propagates through continuations scheduled on the dying pool.
+        chained = pool.enqueue_after(1h, [] { return 1; }).then([](int x) { return x + 1; }).then([](int x) {
+            return x + 1;
+        });
+    }
+
+    REQUIRE_THROWS_AS(never.get(), std::future_error);
+    REQUIRE_THROWS_AS(chained.get(), std::future_error);
+}
+
+// A concrete task which splits itself in two until `depth` reaches zero.
+struct Split {
+    riften::BasicThiefpool<Split> *pool = nullptr;
+    std::atomic<int> *leaves = nullptr;
+    int depth = 0;
+
+    void operator()() && {
+        if (depth == 0) {
+            leaves->fetch_add(1, std::memory_order_relaxed);
+        } else {
+            pool->push({pool, leaves, depth - 1});
+            pool->push({pool, leaves, depth - 1});
+        }
+    }
+};
+
+static_assert(std::is_same_v<riften::Thiefpool, riften::BasicThiefpool<riften::detail::task>>);
+static_assert(!riften::BasicThiefpool<Split>::erased);
+
+TEST_CASE("Typed pool" * doctest::timeout(25)) {
+    std::atomic<int> leaves = 0;
+
+    riften::BasicThiefpool<Split> pool(4);
+
+    pool.push({&pool, &leaves, 12});
+
+    std::vector<Split> bulk(100, Split{&pool, &leaves, 0});
+
+    pool.enqueue_bulk(bulk.begin(), bulk.end());
+
+    pool.wait_idle();
+
+    REQUIRE(leaves.load() == (1 << 12) + 100);
+}
+
+TEST_CASE("Affinity - pinned tasks run on their worker" * doctest::timeout(25)) {
+    constexpr std::size_t workers = 4;
+
+    riften::Thiefpool pool(workers);
+
+    std::vector<std::vector<riften::Future<std::thread::id>>> ran(workers);
+
+    for (int i = 0; i < 100; ++i) {
+        for (std::size_t w = 0; w < workers; ++w) {
+            ran[w].push_back(
+                pool.enqueue_on(w, riften::Affinity::pinned, [] { return std::this_thread::get_id(); }));
+        }
+    }
+
+    std::vector<std::thread::id> owner;
+
+    for (auto &futures : ran) {
+        std::thread::id first = futures[0].get();
+        for (std::size_t i = 1; i < futures.size(); ++i) {
+            REQUIRE(futures[i].get() == first);
+        }
+        owner.push_back(first);
+    }
+
+    std::sort(owner.begin(), owner.end());
+
+    REQUIRE(std::adjacent_find(owner.begin(), owner.end()) == owner.end());
+}
+
+TEST_CASE("Affinity - keyed routing" * doctest::timeout(25)) {
+    riften::Thiefpool pool(3);
+
+    std::atomic<int> count = 0;
+
+    for (int key = 0; key < 1000; ++key) {
+        REQUIRE(pool.worker_for(key) < pool.size());
+        REQUIRE(pool.worker_for(key) == pool.worker_for(key));
+        pool.enqueue_detach_on(pool.worker_for(key), [&] { count.fetch_add(1, std::memory_order_relaxed); });
+    }
+
+    pool.wait_idle();
+
+    REQUIRE(count == 1000);
+}
+
+namespace {
+
+// A pool whose only worker is stuck in a task until `release` is called, so nothing leaves the injector.
+struct Blocked {
+    explicit Blocked(riften::Backpressure bp) : pool(1, {}, riften::Placement::floating, bp) {
+        pool.enqueue_detach([this] {
+            started.store(true, std::memory_order_release);
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+        });
+        while (!started.load(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+    }
+
+    void release() { go.store(true, std::memory_order_release); }
+
+    std::atomic<bool> started = false;
+    std::atomic<bool> go = false;
+    riften::Thiefpool pool;
+};
+
+}  // namespace
+
+TEST_CASE("Backpressure - try_enqueue" * doctest::timeout(25)) {
+    Blocked b({.capacity = 4});
+
+    std::atomic<int> count = 0;
+
+    for (int i = 0; i < 4; ++i) {
+        REQUIRE(b.pool.try_enqueue_detach([&] { count.fetch_add(1, std::memory_order_relaxed); }));
+    }
+
+    REQUIRE(!b.pool.try_enqueue_detach([&] { count.fetch_add(1, std::memory_order_relaxed); }));
+    REQUIRE(!b.pool.try_enqueue([] { return 1; }));
+
+    b.release();
+    b.pool.wait_idle();
+
+    REQUIRE(count == 4);
+    REQUIRE(b.pool.try_enqueue([] { return 1; })->get() == 1);
+}
+
+TEST_CASE("Backpressure - run inline" * doctest::timeout(25)) {
+    Blocked b({.capacity = 2, .overflow = riften::Overflow::run_inline});
+
+    std::vector<riften::Future<std::thread::id>> ran;
+
+    for (int i = 0; i < 10; ++i) {
+        ran.push_back(b.pool.enqueue([] { return std::this_thread::get_id(); }));
+    }
+
+    b.release();
+
+    std::size_t inline_runs = 0;
+
+    for (auto &&future : ran) {
+        inline_runs += future.get() == std::this_thread::get_id();
+    }
+
+    REQUIRE(inline_runs == 8);
+}
+
+TEST_CASE("Backpressure - drop oldest" * doctest::timeout(25)) {
+    Blocked b({.capacity = 2, .overflow = riften::Overflow::drop_oldest});
+
+    std::vector<riften::Future<int>> futures;
+
+    for (int i = 0; i < 10; ++i) {
+        futures.push_back(b.pool.enqueue([i] { return i; }));
+    }
+
+    b.release();
+
+    for (int i = 0; i < 8; ++i) {
+        REQUIRE_THROWS_AS(futures[i].get(), std::future_error);
+    }
+
+    REQUIRE(futures[8].get() == 8);
+    REQUIRE(futures[9].get() == 9);
+
+    b.pool.wait_idle();
+}
+
+TEST_CASE("Backpressure - block" * doctest::timeout(25)) {
+    using namespace std::chrono_literals;
+
+    Blocked b({.capacity = 2});
+
+    std::atomic<int> sent = 0;
+
+    std::thread producer([&] {
+        for (int i = 0; i < 10; ++i) {
+            b.pool.enqueue_detach([] {});
+            sent.fetch_add(1, std::memory_order_relaxed);
+        }
+    });
+
+    while (sent.load() < 2) {
+        std::this_thread::yield();
+    }
+
+    // The producer stays blocked at the cap however long we wait.
+    std::this_thread::sleep_for(20ms);
+
+    REQUIRE(sent.load() == 2);
+
+    b.release();
+    producer.join();
+    b.pool.wait_idle();
+
+    REQUIRE(sent.load() == 10);
+}
+
+TEST_CASE("Batch" * doctest::timeout(25)) {
+    riften::Thiefpool pool(4);
+
+    std::vector<std::atomic<int>> hits(1 << 16);
+
+    riften::Batch batch = pool.enqueue_n(hits.size(), [&](std::size_t i) { hits[i].fetch_add(1); });
+
+    REQUIRE(batch.valid());
+
+    batch.get();
+
+    REQUIRE(!batch.valid());
+    REQUIRE(std::all_of(hits.begin(), hits.end(), [](auto const &h) { return h.load() == 1; }));
+
+    riften::Batch empty = pool.enqueue_n(0, [](std::size_t) {});
+
+    empty.wait();
+    REQUIRE(empty.is_ready());
+
+    // Dropping the handle detaches the batch.
+    std::atomic<int> count = 0;
+    (void)pool.enqueue_n(100, [&](std::size_t) { count.fetch_add(1); });
+    pool.wait_idle();
+    REQUIRE(count == 100);
+}
+
+TEST_CASE("Batch - exceptions and nested waits" * doctest::timeout(25)) {
+    riften::Thiefpool pool(1);
+
+    riften::Batch failing = pool.enqueue_n(100, [](std::size_t i) {
+        if (i == 10) {
+            throw std::runtime_error("boom");
+        }
+    });
+
+    REQUIRE_THROWS_AS(failing.get(), std::runtime_error);
+
+    // With a single worker this only finishes because the waiting worker runs the batch.
+    auto nested = pool.enqueue([&pool] {
+        std::vector<std::size_t> out(1000);
+        riften::Batch inner = pool.enqueue_n(out.size(), [&](std::size_t i) { out[i] = i; });
+        pool.wait(inner);
+        return std::accumulate(out.begin(), out.end(), std::size_t{0});
+    });
+
+    std::size_t sum = nested.get();
+
+    REQUIRE(sum == 999 * 1000 / 2);
+}
+
+TEST_CASE("Batch - cancelled tasks break the promise" * doctest::timeout(25)) {
+    Blocked b({});
+
+    std::atomic<int> ran = 0;
+
+    riften::Batch batch = b.pool.enqueue_n(4, [&](std::size_t) { ran.fetch_add(1); });
+
+    REQUIRE(b.pool.cancel_pending() == 4);
+    REQUIRE(batch.is_ready());
+    REQUIRE_THROWS_AS(batch.get(), std::future_error);
+
+    b.release();
+    b.pool.wait_idle();
+
+    REQUIRE(ran == 0);
+}
@@ -0,0 +1,45 @@
+#include "riften/topology.hpp"
+
+#include <atomic>
+#include <set>
+#include <vector>
+
+#include "doctest/doctest.h"
+#include "riften/thiefpool.hpp"
+
+TEST_CASE("Topology - parse cpu-lists") {
+    std::vector<std::size_t> expect{0, 1, 2, 3, 8, 10, 11};
+
+    REQUIRE(riften::detail::parse_cpulist("0-3,8,10-11\n") == expect);
+    REQUIRE(riften::detail::parse_cpulist("5") == std::vector<std::size_t>{5});
+    REQUIRE(riften::detail::parse_cpulist("").empty());
+}
+
+TEST_CASE("Topology - discovery") {
+    std::vector cpus = riften::topology();
+
+    REQUIRE(!cpus.empty());
+
+    std::set<std::size_t> ids;
+
+    for (riften::Cpu const &cpu : cpus) {
+        REQUIRE(ids.insert(cpu.id).second);
+        REQUIRE(riften::detail::distance(cpu, cpu) == 0);
+    }
+}
+
+TEST_CASE("Topology - pinned pool" * doctest::timeout(25)) {
+    for (std::size_t threads : {1, 2, 3, 4, 12}) {
+        riften::Thiefpool pool(threads, {}, riften::Placement::pinned);
+
+        std::atomic<int> count = 0;
+
+        for (int i = 0; i < 1000; ++i) {
+            pool.enqueue_detach([&count] { count.fetch_add(1, std::memory_order_relaxed); });
+        }
+
+        while (count.load(std::memory_order_relaxed) != 1000) {
+            std::this_thread::yield();
+        }
+    }
+}
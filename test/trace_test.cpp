@@ -0,0 +1,108 @@
+#include "riften/trace.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "doctest/doctest.h"
+#include "riften/thiefpool.hpp"
+
+namespace {
+
+std::size_t occurrences(std::string const &haystack, std::string const &needle) {
+    std::size_t count = 0;
+    for (auto pos = haystack.find(needle); pos != std::string::npos; pos = haystack.find(needle, pos + 1)) {
+        ++count;
+    }
+    return count;
+}
+
+}  // namespace
+
+#if defined(RIFTEN_THIEFPOOL_TRACE)
+
+TEST_CASE("Trace - ring keeps the newest events") {
+    riften::detail::TraceRing ring;
+
+    for (std::uint64_t i = 0; i < 3 * RIFTEN_THIEFPOOL_TRACE_CAPACITY + 5; ++i) {
+        ring.record(riften::TraceEvent::steal, i);
+    }
+
+    std::vector events = ring.events();
+
+    // The oldest slot is never read, the writer could be overwriting it.
+    REQUIRE(events.size() == RIFTEN_THIEFPOOL_TRACE_CAPACITY - 1);
+
+    for (std::size_t i = 1; i < events.size(); ++i) {
+        REQUIRE(events[i].arg == events[i - 1].arg + 1);
+        REQUIRE(events[i].ns >= events[i - 1].ns);
+    }
+
+    REQUIRE(events.back().arg == 3 * RIFTEN_THIEFPOOL_TRACE_CAPACITY + 4);
+}
+
+TEST_CASE("Trace - reading while writing" * doctest::timeout(25)) {
+    riften::detail::TraceRing ring;
+
+    std::atomic<bool> stop = false;
+
+    std::thread writer([&] {
+        for (std::uint64_t i = 0; !stop.load(std::memory_order_relaxed); ++i) {
+            ring.record(riften::TraceEvent::enqueue, i);
+        }
+    });
+
+    for (int round = 0; round < 100; ++round) {
+        std::vector events = ring.events();
+        for (std::size_t i = 1; i < events.size(); ++i) {
+            REQUIRE(events[i].arg == events[i - 1].arg + 1);
+        }
+    }
+
+    stop.store(true, std::memory_order_relaxed);
+    writer.join();
+}
+
+TEST_CASE("Trace - pool timeline" * doctest::timeout(25)) {
+    std::ostringstream out;
+    {
+        riften::Thiefpool pool(4);
+
+        std::vector<riften::Future<void>> futures;
+
+        for (int i = 0; i < 100; ++i) {
+            futures.push_back(pool.enqueue([&pool] { pool.enqueue_detach([] {}); }));
+        }
+        for (auto &&future : futures) {
+            future.get();
+        }
+
+        pool.write_trace(out);
+    }
+
+    std::string json = out.str();
+
+    REQUIRE(json.starts_with("{\"traceEvents\":["));
+    REQUIRE(json.ends_with("]}\n"));
+    REQUIRE(occurrences(json, "\"name\":\"thread_name\"") == 5);
+    REQUIRE(occurrences(json, "\"name\":\"task\",\"ph\":\"B\"") >= 100);
+    REQUIRE(occurrences(json, "\"name\":\"enqueue\"") >= 100);
+}
+
+#else
+
+TEST_CASE("Trace - disabled") {
+    riften::Thiefpool pool(2);
+
+    pool.enqueue([] {}).get();
+
+    std::ostringstream out;
+    pool.write_trace(out);
+
+    REQUIRE(occurrences(out.str(), "\"name\":\"task\"") == 0);
+}
+
+#endif
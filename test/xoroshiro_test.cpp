@@ -0,0 +1,39 @@
+#include "riften/xoroshiro128starstar.hpp"
+
+#include <array>
+#include <cstdint>
+
+#include "doctest/doctest.h"
+
+TEST_CASE("Xoroshiro - seeds give distinct streams") {
+    riften::Xoroshiro128StarStar a(0);
+    riften::Xoroshiro128StarStar b(1);
+    riften::Xoroshiro128StarStar c(1);
+
+    REQUIRE(a() != b());
+    REQUIRE(b() != a());
+
+    c();
+    c();
+
+    REQUIRE(b() == c());
+}
+
+TEST_CASE("Xoroshiro - bounded") {
+    riften::Xoroshiro128StarStar rng(42);
+
+    REQUIRE(rng.bounded(1) == 0);
+
+    std::array<int, 7> hits{};
+
+    for (int i = 0; i < 70'000; ++i) {
+        std::uint32_t x = rng.bounded(7);
+        REQUIRE(x < 7);
+        ++hits[x];
+    }
+
+    for (int h : hits) {
+        REQUIRE(h > 9'000);
+        REQUIRE(h < 11'000);
+    }
+}